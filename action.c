@@ -13,20 +13,122 @@
  * And current column gives the current window if we have one.
  */
 
-static void move_pane(struct pane *, int);
+static void move_pane(struct pane *, int, int);
 void send_delete_window(struct pane *, Display *);
 void send_take_focus(struct pane *p, Display *d);
 void send_message(Atom a, Window w, Display *d);
 
-static int edit_command(struct pane *p, struct layout *l);
+static void edit_command(struct pane *p, struct layout *l);
 static void new_command(struct pane *p, struct layout *l);
 
+/*
+ * Actions that step through the layout wait here until the end of an
+ * event batch, see flush_actions(). Consecutive steps of the same kind
+ * are merged into one of the net number of steps.
+ */
+struct queued {
+	int op;
+	int target;
+	int n;
+};
+
+#ifndef ACTION_QUEUE
+#define ACTION_QUEUE 32
+#endif
+
+static struct queued queue[ACTION_QUEUE];
+static int n_queued;
+
+/*
+ * Returns non-zero if an action (op) steps through the layout, so that
+ * doing it (n) times over is one action.
+ */
+int
+step_action(int op)
+{
+	switch (op) {
+	case FocusPane:
+	case FocusColumn:
+	case MovePane:
+	case MoveColumn:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Queues an action (op) to be done (n) times, or does it now if it
+ * does not step, after those already queued.
+ */
+int
+queue_action(Display *display, XContext context, int op, int target,
+             int n, struct layout *layout)
+{
+	struct queued *q;
+
+	if (!step_action(op)) {
+		flush_actions(layout);
+		return handle_action(display, context, op, target, n,
+		    layout);
+	}
+
+	q = (n_queued > 0) ? &queue[n_queued - 1] : NULL;
+	if (q != NULL && q->op == op) {
+		q->n += (q->target == target) ? n : -n;
+		if (q->n < 0) {
+			q->n = -q->n;
+			q->target = (q->target == Forward) ? Backward :
+			    Forward;
+		} else if (q->n == 0)
+			n_queued--;
+		return NoAction;
+	}
+
+	if (n_queued == ACTION_QUEUE)
+		flush_actions(layout);
+	q = &queue[n_queued++];
+	q->op = op;
+	q->target = target;
+	q->n = n;
+
+	return NoAction;
+}
+
+/*
+ * Does the queued actions, and commits the layout once for all of them.
+ */
+void
+flush_actions(struct layout *layout)
+{
+	int i;
+
+	/* Columns left to relayout by events, see relayout_pane() */
+	if (n_queued == 0) {
+		resize_commit(layout);
+		return;
+	}
+
+	TRACE("%d queued actions", n_queued);
+	layout->defer = true;
+	for (i = 0; i < n_queued; i++)
+		handle_action(layout->display, layout->context, queue[i].op,
+		    queue[i].target, queue[i].n, layout);
+	n_queued = 0;
+	resize_commit(layout);
+}
+
+/*
+ * Does an action (op) on the focused pane, (n) times over for the
+ * actions that can be repeated, see key_press().
+ */
 int
 handle_action(Display *display, XContext context, int op, int target,
-              struct layout *layout)
+              int n, struct layout *layout)
 {
 	struct column *c;
-	struct pane *focus;
+	struct pane *focus, *p;
+	int i;
 
 	focus = layout->focus;
 
@@ -38,6 +140,9 @@ handle_action(Display *display, XContext context, int op, int target,
 		toggle_keybind_mode(display);
 		break;
 #endif
+	case ReloadKeys:
+		reload_keys(display);
+		break;
 	case EditCommand:
 		edit_command(focus, layout);
 		break;
@@ -54,7 +159,8 @@ handle_action(Display *display, XContext context, int op, int target,
 		}
 		break;
 	case FocusColumn:
-		c = get_column(layout->column, 1, target);
+		for (c = layout->column, i = 0; c != NULL && i < n; i++)
+			c = get_column(c, 1, target);
 
 		/*
 		 * We tried to find columns that have some panes,
@@ -71,7 +177,9 @@ handle_action(Display *display, XContext context, int op, int target,
 		 * NULL in which case we have column focus but no
 		 * pane focus. That's okay.
 		 */
-		focus_pane(find_pane_by_vpos(focus->y, c), layout);
+		if (c != NULL)
+			focus_pane(find_pane_by_vpos((focus != NULL) ?
+			    focus->y : 0, c), layout);
 
 #ifdef WANT_ONE_PER_COLUMN
 		force_one_maximized(layout->focus->column);
@@ -79,7 +187,8 @@ handle_action(Display *display, XContext context, int op, int target,
 		break;
 	case MoveColumn:
 		if (focus != NULL) {
-			c = get_column(layout->column, 0, target);
+			for (c = layout->column, i = 0; i < n; i++)
+				c = get_column(c, 0, target);
 			remove_pane(focus, 1);
 			manage_pane(focus, c, c->first);
 			focus_pane(focus, layout);
@@ -90,14 +199,16 @@ handle_action(Display *display, XContext context, int op, int target,
 		break;
 	case MovePane:
 		if (focus != NULL && focus->column->n > 1) {
-			move_pane(focus, target);
+			move_pane(focus, target, n);
 		}
 		break;
 	case FocusPane:
-		if (focus != NULL)
-			focus_pane((target == Forward) ?
-			           get_next_pane(focus) :
-			           get_prev_pane(focus), layout);
+		if (focus != NULL) {
+			for (p = focus, i = 0; i < n; i++)
+				p = (target == Forward) ? get_next_pane(p) :
+				    get_prev_pane(p);
+			focus_pane(p, layout);
+		}
 #ifdef WANT_ONE_PER_COLUMN
 		force_one_maximized(focus->column);
 #endif
@@ -109,6 +220,7 @@ handle_action(Display *display, XContext context, int op, int target,
 	case Fullscreen:
 		if (focus != NULL) {
 			focus->flags ^= PF_FULLSCREEN;
+			ewmh_layout();
 			resize_relayout(layout->focus->column);
 		}
 		break;
@@ -142,6 +254,9 @@ handle_action(Display *display, XContext context, int op, int target,
 			focus_pane(find_previous_focus(layout->head, focus), layout);
 		}
 		break;
+	case RestartManager:
+	case QuitManager:
+		return op;	/* Done by main() */
 	default:
 		TRACE("unhandled: %s", OP_STR(op));
 		break;
@@ -163,41 +278,91 @@ new_command(struct pane *focus, struct layout *l)
 
 	draw_frame(p, l);
 	focus_pane(p, l);
-	if (edit_command(p, l) == 0)
-		close_pane(p, l);
+	edit_command(p, l);
 }
 
+/*
+ * Editing has ended: the command (s) is run in place of the pane, or
+ * if cancelled, a pane created for it is closed.
+ */
 void
 edit_finish(const char *s, void *udata)
 {
 	struct pane *p = udata;
+	struct layout *l = p->prompt.layout;
+
+	if (s != NULL) {
+		p->flags |= PF_WANT_RESTART;
+		close_pane(p, l);
+	} else if (p->flags & PF_EMPTY)
+		close_pane(p, l);
+	else if (p->flags & PF_FOCUSED)
+		focus_pane(p, l);	/* Back to the client */
 }
 
 void
 edit_step(const char *s, void *udata)
 {
 	struct pane *p = udata;
-	const char *q;
-	int col;
+	const char *q, *name[PROMPT_CANDIDATES];
+	size_t len, used;
+	int i, j, n;
 
 	TRACE("Edit step: '%s'", s);
 
-	q = history_match(s);
-	if (q != NULL)
-		snprintf(p->prompt.text, sizeof(p->prompt.text), "%s", q);
+	p->prompt.ncandidates = history_complete(s, p->prompt.candidate,
+	    p->prompt.candidate_len, PROMPT_CANDIDATES);
+
+	/*
+	 * While the command name is being typed, fill in with programs
+	 * from $PATH not already offered from history. The names are
+	 * copied, as the index may be replaced while the prompt is open.
+	 */
+	len = strlen(s);
+	if (len > 0 && strpbrk(s, " \t") == NULL)
+		n = path_complete(s, len, name, PROMPT_CANDIDATES);
+	else
+		n = 0;
+	used = 0;
+	for (i = 0; i < n && p->prompt.ncandidates < PROMPT_CANDIDATES; i++) {
+		len = strlen(name[i]);
+		if (len > sizeof(p->prompt.names) - used)
+			break;
+		for (j = 0; j < p->prompt.ncandidates; j++)
+			if (p->prompt.candidate_len[j] == len &&
+			    memcmp(p->prompt.candidate[j], name[i], len) == 0)
+				break;
+		if (j < p->prompt.ncandidates)
+			continue;
+		memcpy(&p->prompt.names[used], name[i], len);
+		p->prompt.candidate[j] = &p->prompt.names[used];
+		p->prompt.candidate_len[j] = len;
+		used += len;
+		p->prompt.ncandidates++;
+	}
+
+	/*
+	 * The rest of the most recent line that begins with what was
+	 * typed is shown after it, to be accepted with Tab.
+	 */
+	p->prompt.hint_len = 0;
+	if ((q = history_match(s, &len)) != NULL && len > strlen(s)) {
+		p->prompt.hint = q + strlen(s);
+		p->prompt.hint_len = len - strlen(s);
+	}
 }
 
-static int
+static void
 edit_command(struct pane *p, struct layout *l)
 {
-	p->flags |= PF_EDIT;
+	if (p == NULL || p->flags & PF_EDIT)
+		return;
+
+	path_refresh();
+	prompt_begin(&p->prompt, edit_finish, edit_step, p);
+	if (p->flags & PF_FOCUSED)
+		focus_pane(p, l);
 	draw_frame(p, l);
-	if (prompt_read(&p->prompt, edit_finish, edit_step, p)) {
-		p->flags |= PF_WANT_RESTART;
-		close_pane(p, l);
-		return 1;
-	}
-	return 0;
 }
 
 void
@@ -218,34 +383,32 @@ close_pane(struct pane *p, struct layout *l)
 }
 
 /*
- * Move pane 'p' in a column to 'direction'.
+ * Move pane 'p' in a column 'n' steps to 'direction'. Moving on from
+ * either end goes around to the other, and the pane is added back only
+ * once whatever the number of steps.
  */
 static void
-move_pane(struct pane *p, int direction)
+move_pane(struct pane *p, int direction, int n)
 {
-	struct pane *after, *target;
+	struct pane *after;
 	struct column *c;
+	int i, m;
 
 	assert(p != NULL);
 
-	if (direction == Forward) {
-		target = p;
-		after = p->next;
-		/* If after is NULL, the move goes to the top */
-	} else {
-		target = p->prev;
-		after = p;
-		if (target == NULL) {
-			target = p;
-			after = p->column->last;
-		}
-	}
-
-	assert(target != NULL);
-	c = target->column;
+	c = p->column;
+	m = c->n;
+	for (i = 0, after = c->first; after != p; after = after->next)
+		i++;
+	if (direction == Forward)
+		i = (i + n) % m;
+	else
+		i = ((i - n) % m + m) % m;
 
-	remove_pane(target, 0);
-	manage_pane(target, c, after);
+	remove_pane(p, 0);
+	for (after = NULL; i > 0; i--)
+		after = (after == NULL) ? c->first : after->next;
+	manage_pane(p, c, after);
 }
 
 void
@@ -302,6 +465,7 @@ minimize(struct pane *p, struct layout *l)
 		transition_pane_state(p, NormalState, l->display);
 		XMapWindow(l->display, p->window);
 	}
+	ewmh_layout();
 
 	if (p->column != NULL) {
 		draw_frame(p, l);
@@ -360,22 +524,26 @@ maybe_url(char *s)
 	return 0;
 }
 
-static void
-run_command(struct pane *pane, char *s)
+/*
+ * Starts a command line (s), which is added to the history if
+ * 'remember' is set. Returns the process ID, or -1.
+ */
+static pid_t
+start_command(const char *s, bool remember)
 {
-	char *q, *p, *cmd, *sh;
+	char *q, *p, *cmd;
 	int i;
-	pid_t pid;
 	size_t sz;
+	pid_t pid;
 	char *prefix;
 
 	if (s == NULL || strlen(s) == 0)
-		return;
+		return -1;
 
 	q = strdup(s);
 	if (q == NULL) {
 		warn("strdup");
-		return;
+		return -1;
 	}
 
 	/* Strip trailing spaces */
@@ -383,13 +551,13 @@ run_command(struct pane *pane, char *s)
 		q[i] = '\0';
 
 	if (q[0] == '!') {
-		prefix = "exec xterm -hold -e ";
+		prefix = "xterm -hold -e ";
 		cmd = q+1;
 	} else if (maybe_url(q)) {
-		prefix = "exec firefox-esr ";
+		prefix = "firefox-esr ";
 		cmd = q;
 	} else {
-		prefix = "exec ";
+		prefix = "";
 		cmd = q;
 	}
 
@@ -397,50 +565,70 @@ run_command(struct pane *pane, char *s)
 	p = malloc(sz);
 	if (p == NULL) {
 		warn("malloc");
-		return;
+		free(q);
+		return -1;
 	}
 
 	if (snprintf(p, sz, "%s%s", prefix, cmd) >= sz)
 		assert(0);
 
-	history_add(q);
+	if (remember)
+		history_add(q);
 	free(q);
 
-	sh = getenv("SHELL");
-	if (sh == NULL) {
-		warn("getenv SHELL");
-		sh = "/bin/sh";
-	}
-	pid = fork();
-	if (pid == 0) {
-		setsid();
-		setenv("DISPLAY", ":0", 1);
-		execl(sh, sh, "-c", p, NULL);
-	} else {
-		if (pid == -1)
-			warn("fork");
-		free(p);
-	}
+	pid = spawn(p);
+	free(p);
+
+	return pid;
 }
 
-void
-restart_pane(struct pane *p, Display *d)
+/*
+ * Runs a command line (s) typed in the prompt of a pane.
+ */
+static pid_t
+run_command(struct pane *pane, const char *s)
 {
-	int i;
-	static char cmd[1024];
+	return start_command(s, true);
+}
 
+/*
+ * Runs the command of a pane (p) again, either what was typed in its
+ * prompt or the command of its window. Returns the process ID, or -1.
+ */
+pid_t
+restart_pane(struct pane *p, Display *d)
+{
 	TRACE("should restart");
-	if (strlen(p->prompt.text)) {
-		run_command(p, p->prompt.text);
-	} else {
-		cmd[0] = 0;
-		strlcat(cmd, "DISPLAY=:0 ", sizeof(cmd));
-		for (i = 0; i < p->argc; i++) {
-			strlcat(cmd, p->argv[i], sizeof(cmd));
-			strlcat(cmd, " ", sizeof(cmd));
-		}
-		strlcat(cmd, "&", sizeof(cmd));
-		TRACE("starting '%s'", cmd);
-		system(cmd);
+	if (strlen(p->prompt.text))
+		return run_command(p, p->prompt.text);
+	else
+		return spawn_argv(p->argc, p->argv);
+}
+
+/*
+ * Runs a command line (s) for a window in a column (c). An empty pane
+ * at the bottom of the column holds its place until the window appears,
+ * see create_pane(). Returns -1 if the command could not be run.
+ */
+int
+launch_command(const char *s, struct column *c, struct layout *l)
+{
+	struct pane *p;
+	pid_t pid;
+
+	p = create_empty_pane(l, c->x);
+	manage_pane(p, c, c->last);
+
+	XMapWindow(l->display, p->frame);
+	XMapSubwindows(l->display, p->frame);
+	draw_frame(p, l);
+
+	/* Scripts do not fill the history of the user */
+	if ((pid = start_command(s, false)) == -1) {
+		close_pane(p, l);
+		return -1;
 	}
+	spawn_reserve(pid, p);
+
+	return 0;
 }
@@ -6,10 +6,11 @@
 #include <unistd.h>
 #include <X11/Xresource.h>
 #include <errno.h>
-#include <sys/wait.h>
+#include <sys/select.h>
 
 static void capture_existing_windows (struct layout *l);
 static void select_root_events       (Display *);
+static void wait_event               (Display *, struct layout *);
 static int  manageable               (Display *, Window);
 static int  wm_rights_error          (Display *, XErrorEvent *);
 
@@ -52,7 +53,7 @@ main(int argc, char *argv[])
 
 #ifdef __OpenBSD__
 #if 1
-	if (pledge("stdio rpath wpath cpath proc exec", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath proc exec unix ps", NULL) == -1)
 		err(1, "pledge");
 #else
 	if (pledge("stdio rpath", NULL) == -1)
@@ -60,6 +61,8 @@ main(int argc, char *argv[])
 #endif
 #endif	
 
+	control_init(display);
+	spawn_init(display);
 	context = XUniqueContext();
 
 	init(display, &layout, columns);
@@ -68,7 +71,16 @@ main(int argc, char *argv[])
 	layout.context = context;
 
 	select_root_events(display);
+	ewmh_init(display);
 	capture_existing_windows(&layout);
+	session_restore(&layout);
+
+	/* Indexed in the background, see history_idle() */
+	history_load();
+	path_refresh();
+
+	/* Held keys repeat as presses only, see key_press() */
+	XkbSetDetectableAutoRepeat(display, True, NULL);
 
 #ifdef STICKYKEYS
 	bind_mode_keys(display, DefaultRootWindow(display));
@@ -81,20 +93,42 @@ main(int argc, char *argv[])
 	running = 1;
 	focus = NULL;
 	while (running) {
-		int status;
-
-#ifndef WAIT_MYPGRP
-#define WAIT_MYPGRP 0
-#endif
 		/*
 		 * Reap zombie processes.
 		 */
-		waitpid(WAIT_MYPGRP, &status, WNOHANG);
+		spawn_reap(&layout);
+
+		/*
+		 * Actions queued in this batch of events are done with
+		 * one layout commit.
+		 */
+		if (XPending(display) == 0)
+			flush_actions(&layout);
+
+		/*
+		 * Background work is done in small steps, only while
+		 * there are no events waiting.
+		 */
+		while (XPending(display) == 0 &&
+		    (history_idle() || path_idle()))
+			;
+
+		if (XPending(display) == 0) {
+			wait_event(display, &layout);
+			continue;
+		}
 
 		XNextEvent(display, &event);
 		switch (handle_event(display, &event, context,
 		                     &layout)) {
 		case RestartManager:
+			/*
+			 * Closing the display puts the windows back on
+			 * the root window for the new instance to capture.
+			 */
+			session_save(&layout);
+			control_exit();
+			XCloseDisplay(display);
 			execvp(*argv, argv);
 			err(1, "restarting");
 			break;
@@ -105,12 +139,57 @@ main(int argc, char *argv[])
 		}
 	}
 
+	control_exit();
 	XSync(display, False);
 	XSetInputFocus(display, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XCloseDisplay(display);
 	return 0;
 }
 
+/*
+ * Sleeps until there are events to read from the X server, a program
+ * we started has exited, or a script has something to say, which is
+ * then served.
+ */
+static void
+wait_event(Display *display, struct layout *l)
+{
+	struct timeval tv, *timeout;
+	fd_set fds;
+	int xfd, cfd, max, n;
+
+	xfd = ConnectionNumber(display);
+	cfd = spawn_fd();
+	max = (xfd > cfd) ? xfd : cfd;
+
+	/* Changes of the batch of events just handled */
+	control_flush();
+	ewmh_commit(l);
+
+	FD_ZERO(&fds);
+	FD_SET(xfd, &fds);
+	FD_SET(cfd, &fds);
+	control_fds(&fds, &max);
+
+	/* A drag position held back is shown if the pointer stops */
+	timeout = NULL;
+	if (l->drag_pending) {
+		tv.tv_sec = 0;
+		tv.tv_usec = DRAG_INTERVAL * 1000;
+		timeout = &tv;
+	}
+	if ((n = select(max + 1, &fds, NULL, NULL, timeout)) == -1) {
+		if (errno != EINTR)
+			err(1, "select");
+		return;
+	}
+	if (n == 0) {
+		drag_flush(l);
+		return;
+	}
+	control_io(&fds, l);
+}
+
 static void
 select_root_events(Display *display)
 {
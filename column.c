@@ -31,6 +31,21 @@ focus_column(struct column *c, struct layout *l)
 */
 }
 
+/*
+ * Returns the position of a column (c) from the left, starting at 0.
+ */
+int
+column_index(struct column *c)
+{
+	struct column *d;
+	int i;
+
+	for (i = 0, d = c->layout->head; d != NULL && d != c; d = d->next)
+		i++;
+
+	return i;
+}
+
 /*
  * Returns previous/next column relative to source column (s).
  * Can return empty/non-empty columns based on a number of panes target (n).
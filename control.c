@@ -0,0 +1,581 @@
+/*
+ * cocowm - Column Commander Window Manager for X11 Window System
+ * Copyright (c) 2023, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Control socket for scripts. Commands are lines of text, e.g.
+ *
+ *	focus pane next 3
+ *	move column prev
+ *	minimize others
+ *	run 2 xterm
+ *	layout
+ *
+ * and each is answered by "ok" or "error", after any lines of output.
+ * The lines read from a client at once are a batch, done between two
+ * X events with one layout commit.
+ *
+ * A client that has sent "subscribe" is also sent a line for each
+ * change in the layout, see control_event(). The lines are made once
+ * for all subscribers and sent after each batch of X events.
+ */
+
+#include "extern.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+struct client {
+	int fd;
+	char buf[PROMPT_MAX];
+	size_t len;
+	bool skip;		/* Rest of a line too long */
+	bool subscribed;
+	struct client *next;
+};
+
+#ifndef FEED_MAX
+#define FEED_MAX 8192
+#endif
+
+static char feed[FEED_MAX];
+static size_t feed_len;
+static int n_subscribers;
+
+static int listen_fd = -1;
+static struct client *clients;
+static struct sockaddr_un sun;
+
+static unsigned long n_clients;
+static unsigned long n_commands;
+static unsigned long n_batches;
+
+static int nonblock(int);
+static int in_use();
+static void accept_client(struct layout *);
+static int read_client(struct client *, struct layout *);
+static void drop_client(struct client **);
+static void reply(struct client *, const char *, ...);
+static char *word(char **);
+static int number(const char *, int);
+static int command(struct client *, char *, struct layout *);
+static void show_layout(struct client *, struct layout *);
+static void scrub(char *, size_t);
+static void send_feed();
+
+static int
+nonblock(int fd)
+{
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Returns non-zero if the socket path is served by a live listener.
+ */
+static int
+in_use()
+{
+	int fd, ret;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return 0;
+	ret = (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) == 0);
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Listens in a directory of our own in /tmp, at a path named after the
+ * display, and tells the path to the programs we start in
+ * $COCOWM_SOCKET. The value we were started with is not used, as it
+ * belongs to whoever started us, e.g. cocowm on another display.
+ * Scripts do without the socket if it cannot be made.
+ */
+void
+control_init(Display *display)
+{
+	char dir[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	sun.sun_family = AF_UNIX;
+	snprintf(dir, sizeof(dir), "/tmp/cocowm-%lu",
+	    (unsigned long) getuid());
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		warn("%s", dir);
+		return;
+	}
+	if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) ||
+	    st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+		warnx("%s: not a private directory", dir);
+		return;
+	}
+	if (snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/%s",
+	    dir, DisplayString(display)) >= sizeof(sun.sun_path)) {
+		warnx("%s: control socket path too long", dir);
+		return;
+	}
+
+	/* Left behind, unless someone still listens there */
+	if (in_use()) {
+		warnx("%s: already in use", sun.sun_path);
+		return;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		warn("control socket");
+		return;
+	}
+	unlink(sun.sun_path);
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1 ||
+	    listen(fd, 8) == -1 || nonblock(fd) == -1) {
+		warn("%s", sun.sun_path);
+		close(fd);
+		return;
+	}
+	listen_fd = fd;
+	setenv("COCOWM_SOCKET", sun.sun_path, 1);
+
+	TRACE("control socket %s", sun.sun_path);
+}
+
+void
+control_exit()
+{
+	if (listen_fd == -1)
+		return;
+
+	while (clients != NULL)
+		drop_client(&clients);
+	close(listen_fd);
+	unlink(sun.sun_path);
+	listen_fd = -1;
+}
+
+/*
+ * Adds the descriptors to wait for to (fds), and raises (max) to the
+ * highest of them.
+ */
+void
+control_fds(fd_set *fds, int *max)
+{
+	struct client *c;
+
+	if (listen_fd == -1)
+		return;
+
+	FD_SET(listen_fd, fds);
+	if (listen_fd > *max)
+		*max = listen_fd;
+	for (c = clients; c != NULL; c = c->next) {
+		FD_SET(c->fd, fds);
+		if (c->fd > *max)
+			*max = c->fd;
+	}
+}
+
+/*
+ * Serves the descriptors that are ready in (fds).
+ */
+void
+control_io(fd_set *fds, struct layout *l)
+{
+	struct client **c;
+
+	if (listen_fd == -1)
+		return;
+
+	for (c = &clients; *c != NULL; )
+		if (FD_ISSET((*c)->fd, fds) && read_client(*c, l) == -1)
+			drop_client(c);
+		else
+			c = &(*c)->next;
+
+	if (FD_ISSET(listen_fd, fds))
+		accept_client(l);
+}
+
+static void
+accept_client(struct layout *l)
+{
+	struct client *c;
+	int fd;
+
+	if ((fd = accept(listen_fd, NULL, NULL)) == -1)
+		return;
+	if (nonblock(fd) == -1 || (c = calloc(1, sizeof(*c))) == NULL) {
+		warn("control client");
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->next = clients;
+	clients = c;
+	n_clients++;
+}
+
+static void
+drop_client(struct client **c)
+{
+	struct client *dead = *c;
+
+	*c = dead->next;
+	if (dead->subscribed)
+		n_subscribers--;
+	close(dead->fd);
+	free(dead);
+}
+
+/*
+ * Reads from a client (c) and does the commands on the lines read.
+ * Returns -1 if the client has gone.
+ */
+static int
+read_client(struct client *c, struct layout *l)
+{
+	ssize_t n;
+	char *s, *nl;
+
+	n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (n <= 0)
+		return -1;
+	c->len += n;
+	c->buf[c->len] = '\0';
+
+	if (c->skip) {
+		if ((nl = strchr(c->buf, '\n')) == NULL) {
+			c->len = 0;
+			return 0;
+		}
+		c->skip = false;
+		c->len -= nl + 1 - c->buf;
+		memmove(c->buf, nl + 1, c->len + 1);
+	}
+
+	/* Keys pressed before come first */
+	flush_actions(l);
+	l->defer = true;
+	for (s = c->buf; (nl = strchr(s, '\n')) != NULL; s = nl + 1) {
+		*nl = '\0';
+		n_commands++;
+		if (command(c, s, l) == 0)
+			reply(c, "ok\n");
+	}
+	resize_commit(l);
+	n_batches++;
+
+	c->len -= s - c->buf;
+	memmove(c->buf, s, c->len);
+	if (c->len == sizeof(c->buf) - 1) {
+		reply(c, "error line too long\n");
+		c->len = 0;
+		c->skip = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes to a client (c), which is dropped at its next read if it does
+ * not keep up.
+ */
+static void
+reply(struct client *c, const char *fmt, ...)
+{
+	char buf[PROMPT_MAX];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n >= sizeof(buf))
+		n = sizeof(buf) - 1;
+
+	if (send(c->fd, buf, n, MSG_NOSIGNAL) != n)
+		shutdown(c->fd, SHUT_RD);
+}
+
+/*
+ * Returns the next word of (*s), or NULL if there are no more.
+ */
+static char *
+word(char **s)
+{
+	char *w;
+
+	*s += strspn(*s, " \t\r");
+	if (**s == '\0')
+		return NULL;
+	w = *s;
+	*s += strcspn(*s, " \t\r");
+	if (**s != '\0')
+		*(*s)++ = '\0';
+
+	return w;
+}
+
+/*
+ * Returns the value of a word (s) of digits only, or -1 if it is not
+ * one or is above (max).
+ */
+static int
+number(const char *s, int max)
+{
+	char *end;
+	long v;
+
+	if (!isdigit((unsigned char) *s))
+		return -1;
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (*end != '\0' || errno != 0 || v > max)
+		return -1;
+
+	return v;
+}
+
+/*
+ * Does a command line (s) of a client (c). Returns 0 when done, or -1
+ * when an error was replied.
+ */
+static int
+command(struct client *c, char *s, struct layout *l)
+{
+	const char *cmd, *what, *dir, *count;
+	const struct spawn_stats *st;
+	struct column *col;
+	char name[sizeof(st->last)];
+	int op, target, n;
+
+	if ((cmd = word(&s)) == NULL)
+		return 0;
+
+	if (strcmp(cmd, "focus") == 0 || strcmp(cmd, "move") == 0) {
+		what = word(&s);
+		dir = word(&s);
+		count = word(&s);
+		if (what != NULL && strcmp(what, "pane") == 0)
+			op = (*cmd == 'f') ? FocusPane : MovePane;
+		else if (what != NULL && strcmp(what, "column") == 0)
+			op = (*cmd == 'f') ? FocusColumn : MoveColumn;
+		else {
+			reply(c, "error %s pane or column\n", cmd);
+			return -1;
+		}
+		if (dir != NULL && strcmp(dir, "next") == 0)
+			target = Forward;
+		else if (dir != NULL && strcmp(dir, "prev") == 0)
+			target = Backward;
+		else {
+			reply(c, "error %s %s next or prev\n", cmd, what);
+			return -1;
+		}
+		n = (count != NULL) ? number(count, INT_MAX) : 1;
+		if (n < 1) {
+			reply(c, "error bad count\n");
+			return -1;
+		}
+		handle_action(l->display, l->context, op, target, n, l);
+	} else if (strcmp(cmd, "minimize") == 0) {
+		what = word(&s);
+		target = (what != NULL && strcmp(what, "others") == 0) ?
+		    Others : NoTarget;
+		handle_action(l->display, l->context, Minimize, target, 1, l);
+	} else if (strcmp(cmd, "maximize") == 0)
+		handle_action(l->display, l->context, Maximize, 0, 1, l);
+	else if (strcmp(cmd, "fullscreen") == 0)
+		handle_action(l->display, l->context, Fullscreen, 0, 1, l);
+	else if (strcmp(cmd, "close") == 0)
+		handle_action(l->display, l->context, KillPane, 0, 1, l);
+	else if (strcmp(cmd, "run") == 0) {
+		what = word(&s);
+		s += strspn(s, " \t");
+		if (what == NULL || *s == '\0') {
+			reply(c, "error run column command\n");
+			return -1;
+		}
+		col = NULL;
+		if ((n = number(what, INT_MAX)) != -1)
+			for (col = l->head; col != NULL && n > 0;
+			    col = col->next)
+				n--;
+		if (col == NULL) {
+			reply(c, "error no column %s\n", what);
+			return -1;
+		}
+		if (launch_command(s, col, l) == -1) {
+			reply(c, "error cannot run %s\n", s);
+			return -1;
+		}
+	} else if (strcmp(cmd, "layout") == 0)
+		show_layout(c, l);
+	else if (strcmp(cmd, "subscribe") == 0) {
+		if (!c->subscribed) {
+			c->subscribed = true;
+			n_subscribers++;
+		}
+	}
+	else if (strcmp(cmd, "metrics") == 0) {
+		for (n = 0, col = l->head; col != NULL; col = col->next)
+			n += col->n;
+		reply(c, "panes %d\n", n);
+		reply(c, "clients %lu\n", n_clients);
+		reply(c, "commands %lu\n", n_commands);
+		reply(c, "batches %lu\n", n_batches);
+		reply(c, "subscribers %d\n", n_subscribers);
+		st = spawn_stats();
+		reply(c, "spawned %lu\n", st->started);
+		reply(c, "spawn_failed %lu\n", st->failed);
+		reply(c, "exited %lu\n", st->exited);
+		reply(c, "exited_error %lu\n", st->errors);
+		reply(c, "killed %lu\n", st->killed);
+		if (st->last[0] != '\0') {
+			snprintf(name, sizeof(name), "%s", st->last);
+			scrub(name, strlen(name));
+			reply(c, "last_exit %d after %ld ms %s\n",
+			    st->last_status, st->last_ms, name);
+		}
+	} else {
+		reply(c, "error unknown command %s\n", cmd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes a line for each column, followed by a line for each of its
+ * panes from top to bottom.
+ */
+static void
+show_layout(struct client *c, struct layout *l)
+{
+	struct column *col;
+	struct pane *p;
+	char name[PROMPT_MAX];
+	int i;
+
+	for (i = 0, col = l->head; col != NULL; i++, col = col->next) {
+		reply(c, "column %d x %d width %d panes %d\n", i, col->x,
+		    col->width, col->n);
+		for (p = col->first; p != NULL; p = p->next) {
+			snprintf(name, sizeof(name), "%s",
+			    (p->name != NULL) ? p->name : "");
+			scrub(name, strlen(name));
+			reply(c, "pane 0x%lx y %d height %d flags 0x%x%s %s\n",
+			    (unsigned long) p->window, p->y, p->height,
+			    p->flags, (p == l->focus) ? " focused" : "", name);
+		}
+	}
+}
+
+/*
+ * Blanks out control characters of (n) bytes of (s), e.g. a newline
+ * in a window title, so that clients cannot forge lines.
+ */
+static void
+scrub(char *s, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if ((unsigned char) s[i] < ' ' || s[i] == 0x7f)
+			s[i] = ' ';
+}
+
+/*
+ * Adds a line to the feed of layout changes, if anyone is listening.
+ * Control characters in the line, e.g. from a window title, are
+ * blanked out.
+ */
+void
+control_event(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (n_subscribers == 0)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(feed + feed_len, sizeof(feed) - feed_len, fmt, ap);
+	va_end(ap);
+	if (n < 0 || feed_len + n + 1 < sizeof(feed)) {
+		if (n > 0) {
+			scrub(feed + feed_len, n);
+			feed_len += n;
+			feed[feed_len++] = '\n';
+		}
+		return;
+	}
+
+	/* Full, send what there is and try again */
+	feed[feed_len] = '\0';
+	send_feed();
+	va_start(ap, fmt);
+	n = vsnprintf(feed, sizeof(feed) - 1, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n > sizeof(feed) - 2)
+		n = sizeof(feed) - 2;
+	scrub(feed, n);
+	feed_len = n;
+	feed[feed_len++] = '\n';
+}
+
+/*
+ * Sends the feed to the subscribers. One that does not keep up is
+ * dropped, see reply().
+ */
+static void
+send_feed()
+{
+	struct client *c;
+
+	for (c = clients; c != NULL; c = c->next)
+		if (c->subscribed &&
+		    send(c->fd, feed, feed_len, MSG_NOSIGNAL) != feed_len)
+			shutdown(c->fd, SHUT_RD);
+	feed_len = 0;
+}
+
+/*
+ * A batch of events has been handled.
+ */
+void
+control_flush()
+{
+	if (feed_len > 0)
+		send_feed();
+}
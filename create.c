@@ -3,8 +3,11 @@
 #include <stdlib.h>
 #include <err.h>
 
+#include <X11/Xatom.h>
+
 static void update_size_hints(struct pane *, XWindowAttributes *, Display *);
 static void update_hints(struct pane *, Display *);
+static pid_t read_pid(Window, Display *);
 
 struct pane *
 create_empty_pane(struct layout *l, int x)
@@ -96,6 +99,32 @@ create_empty_pane(struct layout *l, int x)
 	return p;
 }
 
+/*
+ * Reads _NET_WM_PID of a window (w), which tells if it is from one of
+ * the programs we started. Returns 0 if not set.
+ */
+static pid_t
+read_pid(Window w, Display *d)
+{
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data;
+	pid_t pid;
+
+	pid = 0;
+	if (XGetWindowProperty(d, w, XInternAtom(d, "_NET_WM_PID", False),
+	    0, 1, False, XA_CARDINAL, &type, &format, &n, &after,
+	    &data) != Success)
+		return 0;
+	if (type == XA_CARDINAL && format == 32 && n == 1)
+		pid = *(unsigned long *) data;
+	if (data != NULL)
+		XFree(data);
+
+	return pid;
+}
+
 /*
  * Creates a managed window (a pane in our terminology) by reparenting
  * an unmanaged window (w) with a frame that allows control of the
@@ -113,10 +142,12 @@ create_empty_pane(struct layout *l, int x)
 struct pane *
 create_pane(Window w, struct layout *l)
 {
-	struct pane          *p;
+	struct pane          *p, *after;
+	struct column        *c;
 	XWindowAttributes     a;
-	int                   rheight;
+	int                   rheight, held;
 	XSetWindowAttributes  sa;
+	pid_t                 pid;
 
 	assert(l != NULL);
 
@@ -143,7 +174,18 @@ create_pane(Window w, struct layout *l)
 		return NULL;
 	}
 
-	p = create_empty_pane(l, a.x);
+	/*
+	 * The window of a program restarted in a pane takes the place
+	 * of its old window, see observedestroy().
+	 */
+	pid = read_pid(w, l->display);
+	if ((p = spawn_claim(pid)) != NULL && (p->flags & PF_EMPTY)) {
+		TRACE("create: %s held for pid %ld", PANE_STR(p), (long) pid);
+		held = 1;
+	} else {
+		p = create_empty_pane(l, a.x);
+		held = 0;
+	}
 	p->flags &= ~PF_EMPTY;
 
 	/* TODO: Get this from createnotify or something */
@@ -163,6 +205,7 @@ create_pane(Window w, struct layout *l)
 	update_hints(p, l->display);
 	update_size_hints(p, &a, l->display);
 	read_pane_protocols(p, l->display);
+	p->pid = pid;
 
 	if (p->flags & PF_MINIMIZED)
 		transition_pane_state(p, IconicState, l->display);
@@ -175,7 +218,16 @@ create_pane(Window w, struct layout *l)
 		a.height = rheight - (l->titlebar_height_px);
 	}
 
-	p->height = a.height + (l->titlebar_height_px);
+	if (!held)
+		p->height = a.height + (l->titlebar_height_px);
+	else if (p->height <= l->titlebar_height_px && p->column != NULL) {
+		/* Only a prompt so far, make room for the window */
+		c = p->column;
+		after = p->prev;
+		remove_pane(p, 0);
+		p->height = a.height + (l->titlebar_height_px);
+		manage_pane(p, c, after);
+	}
 
 	TRACE("create: p->height is: %d", p->height);
 
@@ -203,72 +255,81 @@ create_pane(Window w, struct layout *l)
 	XChangeWindowAttributes(l->display, w, CWEventMask | CWDontPropagate,
 	                        &sa);
 
+	/*
+	 * The frame of a held pane is mapped already, so there is no
+	 * MapNotify for it to reparent the window from.
+	 */
+	if (held)
+		XReparentWindow(l->display, w, p->frame, 0,
+		    l->titlebar_height_px);
+
+	control_event("create 0x%lx", w);
+	ewmh_add(w);
+
 	return p;
 }
 
-static void
-update_size_hints(struct pane *p, XWindowAttributes *a, Display *d)
+/*
+ * Reads WM_NORMAL_HINTS of a pane (p) into the pane so that the layout
+ * can size the client window to what it accepts. Heights are in pixels
+ * of the client window, titlebar excluded. Zero maximum means unlimited.
+ *
+ * As per ICCCM, base size falls back to minimum size and vice versa,
+ * and acceptable heights are base_height + k * height_inc.
+ */
+void
+read_size_hints(struct pane *p, Display *d)
 {
 	XSizeHints normal;
 	long supplied;
-	int min_height_px, j;
+
+	p->min_height = p->max_height = p->base_height = 0;
+	p->height_inc = 1;
 
 	if (XGetWMNormalHints(d, p->window, &normal, &supplied) == 0) {
 		TRACE_ERR("hints: none for %lx", p->window);
-	} else {
-		/* Minimum size */
-		if ((normal.flags & (PBaseSize | PResizeInc | PMinSize)) ==
-		    (PBaseSize | PResizeInc | PMinSize)) {
-			/*
-			 * This algorithm is from Xlib Programming Manual
-			 * X11R5 section 12.3.1.3.
-			 */
-			for (j = 0; j < normal.min_height; j++) {
-				min_height_px = normal.base_height +
-				                (j * normal.height_inc);
-			}
-			if (a->height < min_height_px) {
-				TRACE("hints: minheight is set to %d", min_height_px);
-				a->height = min_height_px;
-			}
-
-			p->min_height = min_height_px;
-
-			TRACE("hints: baseheight with resize increments");
-		} else if (normal.flags & PBaseSize) {
-			if (a->height < normal.base_height) {
-				TRACE("hints: minsize set because %d!!!", a->height);
-				a->height = normal.base_height;
-			}
-
-			p->min_height = normal.base_height;
-
-			TRACE("hints: baseheight only, minheight %d, height now %d", p->min_height, a->height);
-		} else if (normal.flags & PMinSize) {
-			if (a->height < normal.min_height) {
-				TRACE("hints: minsize set because %d", a->height);
-				a->height = normal.min_height;
-			}
-
-			p->min_height = normal.min_height;
-
-			TRACE("hints: minheight only");
-		}
+		return;
+	}
 
-		/* Maximum size */
-		if (normal.flags & PMaxSize) {
-			if (a->height > normal.max_height) {
-				TRACE("hints: max height is set!!");
-				a->height = normal.max_height;
-			}
+	if (normal.flags & PBaseSize)
+		p->base_height = normal.base_height;
+	else if (normal.flags & PMinSize)
+		p->base_height = normal.min_height;
 
-			p->max_height = normal.max_height;
-		}
+	if (normal.flags & PMinSize)
+		p->min_height = normal.min_height;
+	else if (normal.flags & PBaseSize)
+		p->min_height = normal.base_height;
+
+	if (normal.flags & PMaxSize)
+		p->max_height = normal.max_height;
 
-		TRACE("hints: minmax height set for pane %ld "
-		    "to be min=%dpx max=%dpx and current height is %d",
-		    PANE_NUMBER(p),
-		    p->min_height, p->max_height, a->height);
+	if (normal.flags & PResizeInc && normal.height_inc > 0)
+		p->height_inc = normal.height_inc;
+
+	if (p->min_height < 0)
+		p->min_height = 0;
+	if (p->max_height < 0 ||
+	    (p->max_height > 0 && p->max_height < p->min_height))
+		p->max_height = 0;
+
+	TRACE("hints: pane %ld min=%dpx max=%dpx base=%dpx inc=%dpx",
+	    PANE_NUMBER(p), p->min_height, p->max_height,
+	    p->base_height, p->height_inc);
+}
+
+static void
+update_size_hints(struct pane *p, XWindowAttributes *a, Display *d)
+{
+	read_size_hints(p, d);
+
+	if (a->height < p->min_height) {
+		TRACE("hints: minheight is set to %d", p->min_height);
+		a->height = p->min_height;
+	}
+	if (p->max_height > 0 && a->height > p->max_height) {
+		TRACE("hints: max height is set to %d", p->max_height);
+		a->height = p->max_height;
 	}
 }
 
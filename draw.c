@@ -112,7 +112,7 @@ void
 draw_frame(struct pane *p, struct layout *l)
 {
 	char number_str[20];
-	int x, y, prompt_x;
+	int x, y;
 	XftColor bg;
 
 	TRACE("try draw frame of %s", PANE_STR(p));
@@ -140,11 +140,10 @@ draw_frame(struct pane *p, struct layout *l)
 
 	x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg, bg,
 	    x, x, y, number_str, strlen(number_str));
-	prompt_x = x;
 
 	if (p->flags & PF_EDIT) {
-		x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg, bg,
-		    x, x, y, p->prompt.text, strlen(p->prompt.text));
+		p->prompt.x = x;
+		draw_prompt(p, l, 0);
 	} else if (p->name != NULL && (p->flags & PF_MINIMIZED) == 0) {
 		x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg, bg,
 		    x, x, y, p->name, strlen(p->name));
@@ -153,18 +152,80 @@ draw_frame(struct pane *p, struct layout *l)
 		    x, x, y, p->icon_name, strlen(p->icon_name));
 	}
 
+	if (p->flags & PF_FULLSCREEN)
+		draw_border(p->frame, region_width(l->display, l->column->x), l->titlebar_height_px, false, l);
+	else 
+		draw_border(p->frame, l->column->width, l->titlebar_height_px, false, l);
+}
+
+/*
+ * Draws the prompt of a pane (p) from column (from) on: the line with
+ * the cursor, then the completions. An edit changes nothing before the
+ * column it was made at, so only the rest is drawn again.
+ */
+void
+draw_prompt(struct pane *p, struct layout *l, size_t from)
+{
+	struct prompt *pr = &p->prompt;
+	const char *s;
+	size_t i, n, after;
+	int x, y, k;
+	XftColor bg;
+
+	if (XftDrawDrawable(p->ftdraw) != p->frame)
+		XftDrawChange(p->ftdraw, p->frame);
+
+	if (p->flags & PF_FOCUSED)
+		bg = l->text_active_bg;
+	else
+		bg = l->text_inactive_bg;
+
+	/* The column is never past the cursor */
+	for (i = 0, n = from; i < pr->gap && n > 0; n--)
+		while (++i < pr->gap && (pr->buf[i] & 0xc0) == 0x80)
+			;
+
+	y = 1;
+	x = pr->x + (from - n) * l->font_width_px;
+	XClearArea(l->display, p->frame, x, 0, 0, l->titlebar_height_px,
+	    False);
+
+	x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg, bg,
+	    x, x, y, &pr->buf[i], pr->gap - i);
+
 	/*
-	 * Draw cursor.
+	 * The cursor is on the character after it, on the completion
+	 * shown at the end of the line, or on a space.
 	 */
-	if (p->flags & PF_EDIT) {
-		prompt_x += ((p->prompt.cursor - p->prompt.text) * l->font_width_px);
-		x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg,
-		    l->text_cursor, prompt_x, prompt_x, y,
-		    *p->prompt.cursor != '\0' ? p->prompt.cursor : " ", 1);
+	after = PROMPT_MAX - pr->gap_end;
+	if (after > 0) {
+		s = &pr->buf[pr->gap_end];
+		n = after;
+	} else {
+		s = (pr->hint_len > 0) ? pr->hint : " ";
+		n = (pr->hint_len > 0) ? pr->hint_len : 1;
+	}
+	for (i = 1; i < n && (s[i] & 0xc0) == 0x80; i++)
+		;
+	x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg,
+	    l->text_cursor, x, x, y, s, i);
+	x += font_draw(p->ftdraw, l->display, p->frame, l->text_fg,
+	    (after > 0) ? bg : l->text_inactive_bg, x, x, y, &s[i], n - i);
+
+	/*
+	 * Draw ranked completions after the prompt, as far as they fit.
+	 */
+	for (k = 0; k < pr->ncandidates; k++) {
+		x += l->font_width_px * 2;
+		x += font_draw(p->ftdraw, l->display, p->frame,
+		    l->text_fg, l->text_inactive_bg, x, x, y,
+		    pr->candidate[k], pr->candidate_len[k]);
 	}
 
 	if (p->flags & PF_FULLSCREEN)
-		draw_border(p->frame, region_width(l->display, l->column->x), l->titlebar_height_px, false, l);
-	else 
-		draw_border(p->frame, l->column->width, l->titlebar_height_px, false, l);
+		draw_border(p->frame, region_width(l->display, l->column->x),
+		    l->titlebar_height_px, false, l);
+	else
+		draw_border(p->frame, l->column->width,
+		    l->titlebar_height_px, false, l);
 }
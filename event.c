@@ -1,6 +1,7 @@
 #include "extern.h"
 
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,35 +10,67 @@
 static void observemap         (Display *, XContext, Window, struct layout *);
 static void interceptconfigure (struct pane *, struct layout *, XContext, Window, XConfigureRequestEvent);
 static void observe_unmap(Display *, XContext, Window, struct layout *);
+static void send_configure_notify(struct pane *, struct layout *);
 
 static void handle_button_release (XEvent *, struct layout *);
 static void handle_button_press   (Display *, XContext, XEvent *, struct layout *);
 static void snap_pane             (XEvent *, struct layout *);
+static void drag_motion           (XEvent *, struct layout *);
+#ifndef WANT_OUTLINE_DRAG
+static void drag_show             (struct layout *);
+#endif
+#ifndef WANT_OUTLINE_DRAG
+static int  drag_resize_limit     (struct pane *, int, struct layout *);
+#endif
 
 static void draw(Window w, struct layout *l);
+static void hold_pane(struct pane *, struct layout *);
+static void relayout_pane(struct pane *);
 
 int
 handle_event(Display *display, XEvent *event, XContext context,
              struct layout *layout)
 {
-	int op, target;
+	int op, target, n;
 
 	if (event->type != MotionNotify &&	/* Avoid logging too much */
 	    event->type != Expose && event->type != ConfigureNotify)
 		TRACE_BEGIN("event: %s (xany.window: %lx)", EVENT_STR(event),
 		            event->xany.window);
 
-	if (event->type == KeyRelease) {
+	/*
+	 * Keys come to a window of ours other than the root only while
+	 * a prompt has the keyboard, see prompt_focus().
+	 */
+	if (event->type == KeyPress) {
+		struct pane *p;
+
 		if ((op = find_binding(&(event->xkey), &target)) == -1) {
-			TRACE("key without registered action " \
-			      "- how this can happen?");
+			/* Typed after the queued actions are done */
+			flush_actions(layout);
+			p = find_pane_by_window(event->xkey.window, layout);
+			if (p != NULL && p->flags & PF_EDIT)
+				prompt_key(&p->prompt, &(event->xkey));
 			return NoAction;
 		}
+		if ((n = key_press(display, &(event->xkey), op)) == 0)
+			return NoAction;
 		TRACE("handling user action");
-		return handle_action(display, context, op, target, layout);
+		return queue_action(display, context, op, target, n, layout);
 	}
 
+	if (event->type == KeyRelease) {
+		key_release(display, &(event->xkey));
+		return NoAction;
+	}
+
+	/* Queued actions go before anything else changes */
+	flush_actions(layout);
+
 	switch (event->type) {
+		case MappingNotify:
+			remap_keys(&event->xmapping);
+			break;
 		case ButtonPress: {
 			struct pane *p;
 
@@ -58,7 +91,9 @@ handle_event(Display *display, XEvent *event, XContext context,
 			XChangeActivePointerGrab(display, ButtonMotionMask | ButtonReleaseMask, None, CurrentTime);
 #endif
 
+#ifdef WANT_OUTLINE_DRAG
 			XGrabServer(display);
+#endif
 
 			layout->outline_y = p->y;
 			layout->outline_x = p->column->x;
@@ -85,6 +120,7 @@ handle_event(Display *display, XEvent *event, XContext context,
 #if 0
 			XAllowEvents(layout->display, SyncPointer, CurrentTime);
 #endif
+#ifdef WANT_OUTLINE_DRAG
 				if (layout->has_outline) {
 					draw_outline(layout->active,
 					             layout->outline_x,
@@ -93,6 +129,9 @@ handle_event(Display *display, XEvent *event, XContext context,
 					layout->has_outline = false;
 				}
 				XUngrabServer(display);
+#else
+				layout->has_outline = false;
+#endif
 
 				handle_button_release(event, layout);
 			} else {
@@ -107,39 +146,13 @@ handle_event(Display *display, XEvent *event, XContext context,
 			}
 	}
 			break;
-		case MotionNotify: {
-			if (1 || event->xbutton.y < 20) {
+		case MotionNotify:
 			/*
 			 * TODO: Disallow motion events unless we've
 			 *       got an active click to right place
 			 */
-#if 0
-			assert(layout->active != NULL);
-#endif
-			if (layout->active != NULL) {
-				layout->dblclick_time = 0;
-
-				/* Undraw previous frame */
-				if (layout->has_outline)
-					draw_outline(layout->active,
-					             layout->outline_x,
-					             layout->outline_y,
-					             layout);
-
-				/* Draw */
-				layout->outline_x = event->xmotion.x_root -
-				                    layout->active_x;
-				layout->outline_y = event->xmotion.y_root -
-				                    layout->active_y;
-				draw_outline(layout->active,
-				             layout->outline_x,
-				             layout->outline_y, layout);
-				layout->has_outline = true;
-			}
-		}
-
-		}
-
+			if (layout->active != NULL)
+				drag_motion(event, layout);
 			break;
 		case Expose:
 			if (event->xexpose.count == 0)
@@ -204,7 +217,7 @@ handle_event(Display *display, XEvent *event, XContext context,
 #endif
 				TRACE("...height is set to: %d", p->height);
 			}
-			if (p->column != NULL)
+			if (p != NULL && p->column != NULL)
 				resize_relayout(p->column);
 
 #if 0
@@ -225,11 +238,26 @@ handle_event(Display *display, XEvent *event, XContext context,
 			struct pane *p;
 
 			p = find_pane_by_window(event->xproperty.window, layout);
-			if (p != NULL) {
+			if (p != NULL &&
+			    event->xproperty.atom == XA_WM_NORMAL_HINTS) {
+				TRACE("size hints changed");
+				read_size_hints(p, layout->display);
+				if (p->column != NULL)
+					resize_relayout(p->column);
+			} else if (p != NULL) {
 				TRACE("handling property notify the ugly way");
+				if (p->name != NULL)
+					XFree(p->name);
+				if (p->icon_name != NULL)
+					XFree(p->icon_name);
+				p->name = p->icon_name = NULL;
 				XFetchName(layout->display, p->window, &p->name);
 				XGetIconName(layout->display, p->window, &p->icon_name);
 				draw_frame(p, layout);
+				if (event->xproperty.atom == XA_WM_NAME)
+					control_event("title 0x%lx %s",
+					    p->window, (p->name != NULL) ?
+					    p->name : "");
 			}
 			break;
 		}
@@ -265,8 +293,12 @@ handle_event(Display *display, XEvent *event, XContext context,
 			p = find_pane_by_window(event->xreparent.window, layout);
 			if (p != NULL) {
 				p->flags |= PF_REPARENTED;
-				XMapWindow(display, event->xreparent.window);
-				resize_relayout(p->column);
+				/* Reparenting moved the client in the frame */
+				p->conf_client_height = 0;
+				if (!(p->flags & PF_MINIMIZED))
+					XMapWindow(display,
+					    event->xreparent.window);
+				relayout_pane(p);
 			}
 			/*
 			 * At this point we can safely focus and get events
@@ -276,10 +308,15 @@ handle_event(Display *display, XEvent *event, XContext context,
 			XSelectInput(display, event->xreparent.window,
 			    SubstructureNotifyMask | ResizeRedirectMask | PropertyChangeMask);
 
+			/*
+			 * With PointerMotionHintMask the server sends only one
+			 * MotionNotify until we ask where the pointer is, so
+			 * fast mice do not fill the queue during drags.
+			 */
 			XSelectInput(display, event->xreparent.parent,
 			             ButtonPressMask | ButtonReleaseMask |
-			             ButtonMotionMask | ExposureMask |
-			             SubstructureNotifyMask);
+			             ButtonMotionMask | PointerMotionHintMask |
+			             ExposureMask | SubstructureNotifyMask);
 			break;
 		} default:
 			TRACE_ERR("unhandled event: %s", EVENT_STR(event));
@@ -304,9 +341,10 @@ handle_button_release(XEvent *event, struct layout *layout)
 
 	/*
 	 * We may have got motion notify events in the queue,
-	 * let's get rid of those.
+	 * let's get rid of all of those.
 	 */
-	XCheckMaskEvent(layout->display, ButtonMotionMask, &junk);
+	while (XCheckMaskEvent(layout->display, ButtonMotionMask, &junk))
+		;
 
 	TRACE("buttonrelease - buttonpress time: %ld",
 	      event->xbutton.time - layout->dblclick_time);
@@ -327,6 +365,166 @@ handle_button_release(XEvent *event, struct layout *layout)
 	snap_pane(event, layout);
 }
 
+/*
+ * Follows the pointer while a pane is being dragged by its titlebar.
+ *
+ * Only the latest of the motion events already queued is used, and the
+ * screen is updated at most once per DRAG_INTERVAL milliseconds, which
+ * is about one display refresh. By default the frame itself is moved
+ * (opaque drag) so that the server need not be grabbed and other clients
+ * keep on drawing; WANT_OUTLINE_DRAG gives the old XOR outline instead,
+ * which does need the grab.
+ *
+ * While the pointer stays in the pane's own column, the drag is a resize
+ * and only the pane and the one above it are reconfigured; the rest of
+ * the column follows when snap_pane() commits the layout on release.
+ * A position held back by DRAG_INTERVAL is shown by drag_flush() if no
+ * more motion follows.
+ */
+
+static void
+drag_motion(XEvent *event, struct layout *layout)
+{
+	XMotionEvent motion;
+	XEvent next;
+	Window root, child;
+	int x, y;
+	unsigned int mask;
+#ifndef WANT_OUTLINE_DRAG
+	struct pane *pane;
+	struct column *column;
+#endif
+
+	motion = event->xmotion;
+	while (XCheckTypedWindowEvent(layout->display, motion.window,
+	    MotionNotify, &next))
+		motion = next.xmotion;
+
+	/*
+	 * Querying the pointer both gives the latest position and asks
+	 * the server for the next hint, so it is done even if the screen
+	 * is not going to be updated this time.
+	 */
+	if (motion.is_hint == NotifyHint &&
+	    XQueryPointer(layout->display, motion.window, &root, &child,
+	    &motion.x_root, &motion.y_root, &x, &y, &mask) == False)
+		return;
+
+	layout->dblclick_time = 0;
+
+#ifdef WANT_OUTLINE_DRAG
+	/* Undraw previous frame */
+	if (layout->has_outline)
+		draw_outline(layout->active, layout->outline_x,
+		    layout->outline_y, layout);
+#endif
+
+	layout->outline_x = motion.x_root - layout->active_x;
+	layout->outline_y = motion.y_root - layout->active_y;
+
+#ifdef WANT_OUTLINE_DRAG
+	draw_outline(layout->active, layout->outline_x, layout->outline_y,
+	    layout);
+	layout->has_outline = true;
+#else
+	pane = layout->active;
+	column = find_column(layout->head, motion.x_root);
+
+	/*
+	 * Within its own column the titlebar is the boundary between
+	 * the pane and the one above it, so only a resize that
+	 * snap_pane() can carry out on release is shown.
+	 */
+	if (column == pane->column)
+		layout->outline_y = pane->y +
+		    drag_resize_limit(pane, layout->outline_y - pane->y,
+		    layout);
+
+	if (layout->has_outline &&
+	    motion.time - layout->drag_time < DRAG_INTERVAL) {
+		layout->drag_pending = true;
+		return;
+	}
+	layout->drag_time = motion.time;
+	drag_show(layout);
+#endif
+}
+
+/*
+ * Shows a position of the pane being dragged held back by drag_motion(),
+ * once the pointer has stayed still for DRAG_INTERVAL, see wait_event().
+ */
+void
+drag_flush(struct layout *layout)
+{
+#ifndef WANT_OUTLINE_DRAG
+	if (layout->drag_pending && layout->active != NULL)
+		drag_show(layout);
+#endif
+	layout->drag_pending = false;
+}
+
+#ifndef WANT_OUTLINE_DRAG
+/*
+ * Shows the pane being dragged at the position last seen.
+ */
+static void
+drag_show(struct layout *layout)
+{
+	struct pane *pane = layout->active;
+	struct column *column;
+	int dpx;
+
+	layout->has_outline = true;
+	layout->drag_pending = false;
+	column = find_column(layout->head,
+	    layout->outline_x + layout->active_x);
+
+	if (column == pane->column) {
+		dpx = layout->outline_y - pane->y;
+		if (pane->prev != NULL)
+			resize_preview(pane->prev, pane->prev->y,
+			    pane->prev->height + dpx);
+		resize_preview(pane, pane->y + dpx, pane->height - dpx);
+		return;
+	}
+
+	if (pane->prev != NULL && pane->prev->conf_height != pane->prev->height)
+		resize_preview(pane->prev, pane->prev->y, pane->prev->height);
+
+	XMoveWindow(layout->display, pane->frame,
+	    layout->outline_x, layout->outline_y);
+	pane->flags |= PF_DIRTY;
+}
+#endif
+
+#ifndef WANT_OUTLINE_DRAG
+/*
+ * Limits moving the top of a pane (p) by 'dpx' pixels to what can be
+ * taken from or given to the pane above it without making either one
+ * smaller than resize_adjust() allows.
+ */
+static int
+drag_resize_limit(struct pane *p, int dpx, struct layout *l)
+{
+	int minsz;
+
+	minsz = l->titlebar_height_px * 3;
+
+	if (p->prev == NULL || (p->flags | p->prev->flags) & PF_WITHOUT_WINDOW)
+		return 0;
+
+	if (p->prev->height + dpx < minsz)
+		dpx = minsz - p->prev->height;
+	if (p->height - dpx < minsz)
+		dpx = p->height - minsz;
+	if (p->prev->height + dpx < minsz)
+		return 0;
+
+	return dpx;
+}
+#endif
+
 static void
 handle_button_press(Display *display, XContext context, XEvent *event,
                     struct layout *layout)
@@ -437,17 +635,37 @@ snap_pane(XEvent *event, struct layout *layout)
 	} else if (layout->outline_y != pane->y) {
 		dpx = layout->outline_y - pane->y;
 
-		if (pane->prev != NULL) {
+		if (pane->prev != NULL)
 			resize_adjust(pane->column, pane->prev, dpx);
-			resize_relayout(pane->column);
-		}
 		TRACE("Pane moved vertically outline_y=%d pane_y=%d dpx=%d y_adj=%d",
 		    layout->outline_y, pane->y, dpx, pane->y_adj);
 	}
 
+	/*
+	 * Frames shown elsewhere during the drag, see drag_motion(), are
+	 * put where the layout now wants them, even if the drag ended
+	 * where it began. Only frames not there already are configured.
+	 */
+	if (pane->column != NULL)
+		resize_relayout(pane->column);
+
 	layout->active = NULL;
 }
 
+/*
+ * Relayouts the column of a pane (p) whose window was mapped or
+ * reparented. For windows captured at startup, which come many at
+ * once, it is left to the end of the batch of events.
+ */
+static void
+relayout_pane(struct pane *p)
+{
+	if (p->flags & PF_CAPTURE_EXISTING)
+		p->column->dirty = true;
+	else
+		resize_relayout(p->column);
+}
+
 static void
 observemap(Display *display, XContext context, Window window,
            struct layout *layout)
@@ -491,14 +709,19 @@ observemap(Display *display, XContext context, Window window,
 		}
 	} else {
 		TRACE("Got back old window from withdrawn/iconified?");
-		if (pane->column != NULL) {
-			resize_relayout(pane->column);
-		}
+		if (pane->column != NULL)
+			relayout_pane(pane);
 		TRACE("...resize layout complete");
+		/*
+		 * Panes put back by session_restore() keep their focus
+		 * history, so only the one focused is focused again.
+		 */
 		if (pane->flags & PF_REPARENTED) {
 			TRACE("focus pane from observemap 2 (reparent ok)");
-			focus_pane(pane, layout);
-			pane->flags &= ~PF_REPARENTED;
+			if (!(pane->flags & PF_CAPTURE_EXISTING) ||
+			    pane == layout->focus)
+				focus_pane(pane, layout);
+			pane->flags &= ~(PF_REPARENTED | PF_CAPTURE_EXISTING);
 		}
 	}
 
@@ -570,9 +793,8 @@ observe_unmap(Display *display, XContext context, Window window,
 void
 observedestroy(Display *display, XContext context, Window window, struct layout *l)
 {
-	struct pane *pane, *prev;
-	struct column *c;
-	int flags;
+	struct pane *pane;
+	pid_t pid;
 #if 0
 	XEvent event;
 #endif
@@ -583,8 +805,23 @@ observedestroy(Display *display, XContext context, Window window, struct layout
 		TRACE_ERR("destroy: NULL mw in observedestroy");
 		return;
 	}
+	if (!(pane->flags & PF_EMPTY)) {
+		control_event("destroy 0x%lx", pane->window);
+		ewmh_remove(pane->window);
+	}
 
-	prev = pane->prev;
+	/*
+	 * Restarting keeps the pane, its frame and its place in the
+	 * column for the window of the new process, see create_pane().
+	 */
+	if (pane->flags & PF_WANT_RESTART) {
+		pane->flags &= ~PF_WANT_RESTART;
+		if ((pid = restart_pane(pane, display)) != -1) {
+			hold_pane(pane, l);
+			spawn_reserve(pid, pane);
+			return;
+		}
+	}
 
 	/*
 	 * TODO: remove_pane calls resize column, which does operations with
@@ -605,7 +842,6 @@ observedestroy(Display *display, XContext context, Window window, struct layout
 	 * Two modes are needed: unmapped and minimized. Minimized
 	 * is always also unmapped.
 	 */
-	c = pane->column;
 #if 0
 	if (XCheckTypedEvent(display, DestroyNotify, &event) == True) {
 		TRACE("destroy: there was another destroy in queue");
@@ -618,12 +854,7 @@ observedestroy(Display *display, XContext context, Window window, struct layout
 	remove_pane(pane, 1);
 #endif
 
-	if (pane->flags & PF_WANT_RESTART) {
-		if (c != NULL)
-			focus_column(c, l);
-		restart_pane(pane, l->display);
-	}
-	flags = pane->flags;
+	spawn_forget(pane);
 
 	if (pane->frame) {
 		TRACE("destroy: destroying frame %lx in %s", pane->frame,
@@ -655,13 +886,75 @@ observedestroy(Display *display, XContext context, Window window, struct layout
 	l->focus = NULL;
 
 	/* Need to move focus to somewhere else */
-	if (!(flags & PF_WANT_RESTART))
-		focus_pane(find_previous_focus(l->head, NULL), l);
-	else if (prev != NULL)
-		focus_pane(prev, l);
+	focus_pane(find_previous_focus(l->head, NULL), l);
 #endif
 }
 
+/*
+ * Turns a pane (p) whose window has gone into an empty one, which
+ * keeps its height until the window of the restarted program takes
+ * its place.
+ */
+static void
+hold_pane(struct pane *p, struct layout *l)
+{
+	TRACE("holding %s for restart", PANE_STR(p));
+
+	if (!(p->flags & PF_EMPTY)) {
+		XDeleteContext(l->display, p->window, l->context);
+		if (p->name != NULL)
+			XFree(p->name);
+		if (p->icon_name != NULL)
+			XFree(p->icon_name);
+	}
+	p->window = None;
+	p->name = NULL;
+	p->icon_name = NULL;
+	p->pid = 0;
+	p->net_state = 0;
+	p->conf_client_height = 0;
+	p->flags &= ~(PF_MAPPED | PF_REPARENTED | PF_HAS_DELWIN |
+	    PF_HAS_TAKEFOCUS);
+	p->flags |= PF_EMPTY;
+
+	if (p->flags & PF_FOCUSED)
+		focus_pane(p, l);
+	else
+		draw_frame(p, l);
+}
+
+/*
+ * Tells the client of a pane (p) its current geometry, as ICCCM
+ * requires when a ConfigureRequest is not going to be acted upon.
+ */
+static void
+send_configure_notify(struct pane *p, struct layout *l)
+{
+	XConfigureEvent ce;
+
+	/* Not laid out yet, the client will hear from us soon enough */
+	if (p->conf_client_height <= 0)
+		return;
+
+	ce.type = ConfigureNotify;
+	ce.display = l->display;
+	ce.event = p->window;
+	ce.window = p->window;
+	ce.x = p->conf_x;
+	ce.y = p->conf_y + l->titlebar_height_px;
+	ce.width = p->conf_width;
+	ce.height = p->conf_client_height;
+	ce.border_width = 0;
+	ce.above = None;
+	ce.override_redirect = False;
+
+	TRACE("sending synthetic configure %d,%d %dx%d to %s",
+	    ce.x, ce.y, ce.width, ce.height, PANE_STR(p));
+
+	XSendEvent(l->display, p->window, False, StructureNotifyMask,
+	    (XEvent *) &ce);
+}
+
 static void
 interceptconfigure(struct pane *p, struct layout *l, XContext context, Window w,
                    XConfigureRequestEvent e)
@@ -670,9 +963,12 @@ interceptconfigure(struct pane *p, struct layout *l, XContext context, Window w,
 	unsigned long xwcm;
 
 	if (p != NULL) {
-		TRACE("intercepted configure for managed pane, resize column");
-		if (p->column)
+		TRACE("intercepted configure for managed pane");
+		if (p->column != NULL && e.value_mask & CWHeight &&
+		    resize_request(p->column, p, e.height))
 			resize_relayout(p->column);
+		else
+			send_configure_notify(p, l);
 		return;
 	}
 
@@ -0,0 +1,300 @@
+/*
+ * cocowm - Column Commander Window Manager for X11 Window System
+ * Copyright (c) 2023, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Publishes the windows we manage, the active one and the state of each
+ * for pagers, status bars and scripts, as in Extended Window Manager
+ * Hints. Changes are only noted as they happen, and the properties that
+ * changed are written once after each batch of events, see
+ * ewmh_commit().
+ */
+
+#include "extern.h"
+
+#include <err.h>
+#include <X11/Xatom.h>
+
+enum {
+	NetSupported,
+	NetSupportingWmCheck,
+	NetWmName,
+	NetClientList,
+	NetClientListStacking,
+	NetActiveWindow,
+	NetWmState,
+	NetWmStateFullscreen,
+	NetWmStateHidden,
+	NetWmStateFocused,
+	Utf8String,
+	NetLast
+};
+
+static char *atom_names[NetLast] = {
+	"_NET_SUPPORTED",
+	"_NET_SUPPORTING_WM_CHECK",
+	"_NET_WM_NAME",
+	"_NET_CLIENT_LIST",
+	"_NET_CLIENT_LIST_STACKING",
+	"_NET_ACTIVE_WINDOW",
+	"_NET_WM_STATE",
+	"_NET_WM_STATE_FULLSCREEN",
+	"_NET_WM_STATE_HIDDEN",
+	"_NET_WM_STATE_FOCUSED",
+	"UTF8_STRING"
+};
+
+static Atom atoms[NetLast];
+
+/*
+ * What has changed since the last commit.
+ */
+#define EWMH_CLIENTS	(1 << 0)	/* Windows managed */
+#define EWMH_ACTIVE	(1 << 1)	/* Window focused */
+#define EWMH_LAYOUT	(1 << 2)	/* Order or state of windows */
+
+static int dirty;
+
+/*
+ * Windows in the order they were managed, kept up to date as windows
+ * come and go.
+ */
+static Window *clients;
+static size_t n_clients;
+static size_t max_clients;
+
+static Window active;
+
+/* Bits of pane->net_state */
+#define STATE_FULLSCREEN (1 << 0)
+#define STATE_HIDDEN     (1 << 1)
+#define STATE_FOCUSED    (1 << 2)
+
+static void write_stacking(struct layout *);
+static int write_state(struct pane *, Display *);
+static int ewmh_error(Display *, XErrorEvent *);
+
+/*
+ * A window may be gone before we have seen its DestroyNotify.
+ */
+static int
+ewmh_error(Display *display, XErrorEvent *event)
+{
+	TRACE("error in writing window state, window gone");
+	return 0;
+}
+
+/*
+ * Tells that we follow the hints, with a window of our own that names
+ * us.
+ */
+void
+ewmh_init(Display *d)
+{
+	Window root, check;
+
+	if (XInternAtoms(d, atom_names, NetLast, False, atoms) == 0)
+		errx(1, "cannot intern atoms");
+
+	root = DefaultRootWindow(d);
+	check = XCreateSimpleWindow(d, root, -1, -1, 1, 1, 0, 0, 0);
+	XChangeProperty(d, check, atoms[NetSupportingWmCheck], XA_WINDOW,
+	    32, PropModeReplace, (unsigned char *) &check, 1);
+	XChangeProperty(d, check, atoms[NetWmName], atoms[Utf8String], 8,
+	    PropModeReplace, (unsigned char *) "cocowm", 6);
+	XChangeProperty(d, root, atoms[NetSupportingWmCheck], XA_WINDOW, 32,
+	    PropModeReplace, (unsigned char *) &check, 1);
+	XChangeProperty(d, root, atoms[NetSupported], XA_ATOM, 32,
+	    PropModeReplace, (unsigned char *) atoms, NetLast - 1);
+
+	dirty = EWMH_CLIENTS | EWMH_ACTIVE | EWMH_LAYOUT;
+}
+
+/*
+ * A window (w) is now managed.
+ */
+void
+ewmh_add(Window w)
+{
+	Window *v;
+	size_t max;
+
+	if (n_clients == max_clients) {
+		max = (max_clients > 0) ? max_clients * 2 : 64;
+		if ((v = realloc(clients, max * sizeof(*v))) == NULL) {
+			warn("client list");
+			return;
+		}
+		clients = v;
+		max_clients = max;
+	}
+	clients[n_clients++] = w;
+	dirty |= EWMH_CLIENTS;
+}
+
+/*
+ * A window (w) is no longer managed.
+ */
+void
+ewmh_remove(Window w)
+{
+	size_t i;
+
+	for (i = 0; i < n_clients; i++)
+		if (clients[i] == w) {
+			memmove(&clients[i], &clients[i + 1],
+			    (n_clients - i - 1) * sizeof(*clients));
+			n_clients--;
+			dirty |= EWMH_CLIENTS;
+			break;
+		}
+	if (active == w)
+		ewmh_focus(None);
+}
+
+/*
+ * A window (w) has been focused, or None.
+ */
+void
+ewmh_focus(Window w)
+{
+	if (w != active) {
+		active = w;
+		dirty |= EWMH_ACTIVE;
+	}
+	dirty |= EWMH_LAYOUT;		/* For _NET_WM_STATE_FOCUSED */
+}
+
+/*
+ * Panes have moved or changed state. Called on every change of the
+ * flags written to _NET_WM_STATE, even if no window moves.
+ */
+void
+ewmh_layout()
+{
+	dirty |= EWMH_LAYOUT;
+}
+
+/*
+ * Writes what has changed in a layout (l) since the last time.
+ */
+void
+ewmh_commit(struct layout *l)
+{
+	Display *d = l->display;
+	Window root = DefaultRootWindow(d);
+	struct column *c;
+	struct pane *p;
+	int written;
+
+	if (dirty == 0)
+		return;
+
+	if (dirty & EWMH_CLIENTS)
+		XChangeProperty(d, root, atoms[NetClientList], XA_WINDOW, 32,
+		    PropModeReplace, (unsigned char *) clients, n_clients);
+	if (dirty & EWMH_ACTIVE)
+		XChangeProperty(d, root, atoms[NetActiveWindow], XA_WINDOW, 32,
+		    PropModeReplace, (unsigned char *) &active, 1);
+	if (dirty & (EWMH_CLIENTS | EWMH_LAYOUT)) {
+		write_stacking(l);
+		written = 0;
+		XSetErrorHandler(ewmh_error);
+		for (c = l->head; c != NULL; c = c->next)
+			for (p = c->first; p != NULL; p = p->next)
+				written += write_state(p, d);
+		if (written > 0)
+			XSync(d, False);
+		XSetErrorHandler(None);
+	}
+
+	dirty = 0;
+}
+
+/*
+ * Windows from bottom to top: columns do not overlap, so only a
+ * fullscreen window is above the others.
+ */
+static void
+write_stacking(struct layout *l)
+{
+	struct column *c;
+	struct pane *p, *top;
+	Window *v;
+	size_t n;
+
+	if ((v = calloc(n_clients + 1, sizeof(*v))) == NULL) {
+		warn("client list");
+		return;
+	}
+
+	n = 0;
+	top = NULL;
+	for (c = l->head; c != NULL; c = c->next)
+		for (p = c->first; p != NULL && n < n_clients; p = p->next) {
+			if (p->flags & PF_EMPTY)
+				continue;
+			if (p->flags & PF_FULLSCREEN && p->flags & PF_FOCUSED &&
+			    !(p->flags & PF_WITHOUT_WINDOW))
+				top = p;
+			else
+				v[n++] = p->window;
+		}
+	if (top != NULL)
+		v[n++] = top->window;
+
+	XChangeProperty(l->display, DefaultRootWindow(l->display),
+	    atoms[NetClientListStacking], XA_WINDOW, 32, PropModeReplace,
+	    (unsigned char *) v, n);
+	free(v);
+}
+
+/*
+ * Writes _NET_WM_STATE of a pane (p) if it has changed. Returns
+ * non-zero if written.
+ */
+static int
+write_state(struct pane *p, Display *d)
+{
+	Atom v[3];
+	int state, n;
+
+	if (p->flags & PF_EMPTY)
+		return 0;
+
+	state = 0;
+	if (p->flags & PF_FULLSCREEN)
+		state |= STATE_FULLSCREEN;
+	if (p->flags & (PF_MINIMIZED | PF_HIDDEN))
+		state |= STATE_HIDDEN;
+	if (p->flags & PF_FOCUSED)
+		state |= STATE_FOCUSED;
+	if (state == p->net_state)
+		return 0;
+	p->net_state = state;
+
+	n = 0;
+	if (state & STATE_FULLSCREEN)
+		v[n++] = atoms[NetWmStateFullscreen];
+	if (state & STATE_HIDDEN)
+		v[n++] = atoms[NetWmStateHidden];
+	if (state & STATE_FOCUSED)
+		v[n++] = atoms[NetWmStateFocused];
+	XChangeProperty(d, p->window, atoms[NetWmState], XA_ATOM, 32,
+	    PropModeReplace, (unsigned char *) v, n);
+
+	return 1;
+}
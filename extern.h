@@ -7,6 +7,7 @@
 #include <X11/Xft/Xft.h>
 #include <assert.h>
 #include <stdio.h>
+#include <sys/select.h>
 
 #ifndef __OpenBSD__
 #define strlcat(_dst, _src, _dstsize) \
@@ -31,6 +32,8 @@ struct layout
 	struct column *tail;
 
 	struct pane   *focus;
+	unsigned int   return_priority;	/* Next to give, see focus_pane() */
+	bool           defer;		/* Relayout at commit only */
 
 	/*
 	 * Even though this is same as focus->column, we wish to
@@ -45,6 +48,8 @@ struct layout
 	int            outline_x;
 	int            outline_y;
 	bool           has_outline;
+	bool           drag_pending;	/* Position not shown yet */
+	Time           drag_time;
 	Time           dblclick_time;
 	Display       *display;
 	XContext       context;
@@ -64,10 +69,60 @@ struct layout
 	XftFont *ftfont;
 };
 
+/*
+ * Milliseconds between updates of the screen while dragging a pane,
+ * see drag_motion().
+ */
+#ifndef DRAG_INTERVAL
+#define DRAG_INTERVAL 16
+#endif
+
+#define PROMPT_CANDIDATES 5
+#define PROMPT_MAX 512
+
+typedef void (*PromptCallback)(const char *, void *);
+
+struct history;
+
 struct prompt {
-	char           text[512];
-	char          *cursor;
+	/*
+	 * The line is edited in a gap buffer: the text before the cursor
+	 * is at the start of (buf) and the text after it at the end, so
+	 * that editing at the cursor moves nothing. See prompt_text() for
+	 * the line in one piece.
+	 */
+	char           buf[PROMPT_MAX];
+	size_t         gap;		/* The cursor */
+	size_t         gap_end;
+	char           text[PROMPT_MAX];
+
+	/* The line typed, while stepping back in history */
+	char           saved[PROMPT_MAX];
+	size_t         saved_len;
+	unsigned int   history;		/* Lines back */
+	const struct history *history_at;	/* The line shown */
+
+	/* Where the line is drawn, and from which column it changed */
+	int            x;
+	size_t         redraw;
+
+	/* Ranked completions for what has been typed */
+	const char    *candidate[PROMPT_CANDIDATES];
+	size_t         candidate_len[PROMPT_CANDIDATES];
+	int            ncandidates;
+	char           names[PROMPT_MAX];	/* Those from $PATH */
+
+	/* Rest of the most recent line that begins with what was typed */
+	const char    *hint;
+	size_t         hint_len;
+
+	/* While editing, see prompt_begin() */
+	PromptCallback finish;
+	PromptCallback step;
+	void          *udata;
+
 	struct pane   *pane;
+	struct layout *layout;
 	XIM            im;
 	XIC            ic;
 };
@@ -116,6 +171,15 @@ struct pane
 	int            adjusted_height;
 	int            min_height;
 	int            max_height;
+	int            base_height;
+	int            height_inc;
+
+	/* Geometry last configured to the server, frame and client */
+	int            conf_x;
+	int            conf_y;
+	int            conf_width;
+	int            conf_height;
+	int            conf_client_height;
 
 	char           *name;
 	char           *icon_name;
@@ -124,6 +188,8 @@ struct pane
 
 	char           **argv;
 	int            argc;
+	pid_t          pid;		/* _NET_WM_PID, or 0 */
+	int            net_state;	/* _NET_WM_STATE last written */
 
 	/* Relatives */
 	struct column *column;
@@ -146,6 +212,8 @@ struct column
 	struct pane   *first;
 	struct pane   *last;
 
+	bool           dirty;	/* Relayout deferred, see resize_commit() */
+
 	struct layout *layout;
 
 #if 0
@@ -171,11 +239,26 @@ struct frame
 	struct pane   *pane;
 };
 
+/*
+ * Programs started and how they have ended, see spawn_reap().
+ */
+struct spawn_stats
+{
+	unsigned long started;
+	unsigned long failed;		/* Could not be started */
+	unsigned long exited;		/* With status 0 */
+	unsigned long errors;		/* With another status */
+	unsigned long killed;		/* By a signal */
+	char          last[64];		/* Last to end, or empty */
+	int           last_status;	/* Exit status, or -signal */
+	long          last_ms;		/* Time it ran */
+};
+
 void set_ftcolor(Display *dpy, XftColor *dst, int color);
 XftFont *font_load(Display *dpy, char *fontname);
 int font_draw(XftDraw *ftdraw, Display *dpy, Window window, XftColor fg, XftColor bg, int x, int sx, int y, const char *text, size_t len);
 
-void restart_pane(struct pane *p, Display *d);
+pid_t restart_pane(struct pane *p, Display *d);
 
 struct pane * find_pane_by_window(Window w, struct layout *l);
 struct pane * find_previous_focus(struct column *head, struct pane *a);
@@ -195,16 +278,55 @@ void send_take_focus(struct pane *p, Display *d);
 void minimize(struct pane *, struct layout *);
 void minimize_others(struct pane *, struct layout *);
 
-typedef void (*PromptCallback)(const char *, void *);
-
-void prompt_insert(struct prompt *, char *);
 void prompt_init(struct prompt *, struct pane *, struct layout *);
-int prompt_read(struct prompt *, PromptCallback, PromptCallback, void *);
-
-const char *history_match(const char *s);
+void prompt_begin(struct prompt *, PromptCallback, PromptCallback, void *);
+void prompt_focus(struct prompt *, int);
+void prompt_key(struct prompt *, XKeyEvent *);
+const char *prompt_text(struct prompt *);
+
+const char *history_match(const char *s, size_t *len);
+const char *history_walk(const struct history **, int, const char *,
+    size_t *);
+int history_complete(const char *, const char **, size_t *, int);
 void history_load();
-void history_save();
 void history_add(const char *s);
+int history_idle();
+
+/* spawn.c */
+void spawn_init(Display *);
+pid_t spawn(const char *);
+pid_t spawn_argv(int, char **);
+void spawn_reap(struct layout *);
+int spawn_fd();
+void spawn_reserve(pid_t, struct pane *);
+struct pane *spawn_claim(pid_t);
+void spawn_forget(struct pane *);
+const struct spawn_stats *spawn_stats();
+
+/* control.c */
+void control_init(Display *);
+void control_fds(fd_set *, int *);
+void control_io(fd_set *, struct layout *);
+void control_exit();
+void control_event(const char *, ...);
+void control_flush();
+
+/* ewmh.c */
+void ewmh_init(Display *);
+void ewmh_add(Window);
+void ewmh_remove(Window);
+void ewmh_focus(Window);
+void ewmh_layout();
+void ewmh_commit(struct layout *);
+
+/* session.c */
+void session_save(struct layout *);
+void session_restore(struct layout *);
+
+/* path.c */
+void path_refresh();
+int path_idle();
+int path_complete(const char *, size_t, const char **, int);
 
 enum action {
 	NoAction=0,
@@ -223,7 +345,8 @@ enum action {
 	EditCommand,
 	NewCommand,
 	RestartCommand,
-	ToggleMode
+	ToggleMode,
+	ReloadKeys
 };
 
 enum target {
@@ -237,6 +360,7 @@ enum target {
 void submit_pane  (Display *, GC, GC, struct pane *);
 
 void draw_frame(struct pane *p, struct layout *l);
+void draw_prompt(struct pane *p, struct layout *l, size_t from);
 void draw_close_button(struct pane *p, struct layout *l);
 void draw_maximize_button(struct pane *p, struct layout *l);
 void draw_outline(struct pane *p, int x, int y, struct layout *l);
@@ -245,7 +369,11 @@ void
 close_pane(struct pane *p, struct layout *l);
 
 /* action.c */
-int handle_action (Display *, XContext, int, int, struct layout *);
+int handle_action (Display *, XContext, int, int, int, struct layout *);
+int queue_action  (Display *, XContext, int, int, int, struct layout *);
+void flush_actions(struct layout *);
+int step_action   (int);
+int launch_command(const char *, struct column *, struct layout *);
 
 /* keyboard.c */
 int  find_binding (XKeyEvent *, int *);
@@ -253,11 +381,16 @@ void bind_keys    (Display *, Window);
 void bind_mode_keys    (Display *, Window);
 void unbind_keys  (Display *, Window);
 void toggle_keybind_mode(Display *);
+void reload_keys(Display *);
+void remap_keys(XMappingEvent *);
+int  key_press(Display *, XKeyEvent *, int);
+void key_release(Display *, XKeyEvent *);
 
 /* event.c */
 int  handle_event   (Display *, XEvent *, XContext, struct layout *);
 void interceptmap   (Display *, XContext, Window, int);
 void observedestroy (Display *, XContext, Window, struct layout *);
+void drag_flush     (struct layout *);
 
 /* layout.c */
 #if 0
@@ -289,6 +422,7 @@ struct pane* create_pane (Window, Window, int);
 
 struct pane *create_empty_pane(struct layout *, int);
 struct pane * create_pane(Window w, struct layout *l);
+void read_size_hints(struct pane *, Display *);
 
 struct pane * get_prev_pane(struct pane *pane);
 struct pane * get_next_pane(struct pane *pane);
@@ -299,11 +433,13 @@ struct column * get_next_column(struct column *column);
 #endif
 
 struct column *get_column(struct column *, int, int);
+int column_index(struct column *);
 
 /* column.c */
 void draw_column        (Display *, GC, GC, struct column *);
 
 void manage_pane           (struct pane *, struct column *, struct pane *);
+void append_pane(struct pane *, struct column *);
 
 void remove_pane(struct pane *pane, int);
 
@@ -320,6 +456,9 @@ void                    resize_add(struct column *, struct pane *);
 void                    resize_remove(struct column *, struct pane *);
 void                    resize_adjust(struct column *, struct pane *, int);
 void                    resize_relayout(struct column *);
+void                    resize_commit(struct layout *);
+int                     resize_request(struct column *, struct pane *, int);
+void                    resize_preview(struct pane *, int, int);
 
 void cycle_placement    (struct column *, struct pane *, int);
 
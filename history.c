@@ -17,22 +17,126 @@
 
 #include "extern.h"
 
+#include <ctype.h>
 #include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+/*
+ * A history line. Lines loaded from the history file point into a copy
+ * of the file read at startup and are not NUL terminated; lines added
+ * later are copied to the heap.
+ */
 struct history {
-	char *line;
+	const char *line;
+	size_t len;
+	unsigned int uses;	/* Times used */
+	unsigned int last;	/* Value of 'seq' when last used */
 	struct history *prev;
 	struct history *next;
 };
 
+/*
+ * All history lines are also kept in a radix tree, in which every node
+ * knows the most recently used line below it. This way the completion
+ * for what has been typed is found by walking down as many characters
+ * as were typed, regardless of the size of the history. A node where a
+ * line ends points to that line, which is also how adding a line finds
+ * out it is already in the history.
+ *
+ * Labels point into the history lines, which are never freed.
+ */
+struct node {
+	const char *label;
+	size_t len;
+	struct history *line;
+	struct history *recent;
+	struct node *child;
+	struct node *sibling;
+};
+
 static struct history *head;
 static struct history *tail;
+static struct node root;
+static int loaded;
+
+static size_t n_lines;		/* Distinct lines */
+static size_t n_journal;	/* Lines in the history file */
+static unsigned int seq;	/* Bumped every time a line is used */
+
+/*
+ * For ranked completion all distinct lines are also in a flat array,
+ * together with a mask of the characters found in each line. Lines
+ * that cannot match are ruled out with one AND per line before any
+ * closer look.
+ */
+static struct history **lines;
+static uint64_t *masks;
+static size_t lines_max;
+
+/*
+ * The history file as read when loading, and how far it has been
+ * indexed. It is read rather than mapped, so that the file can be
+ * truncated or replaced while the lines point into it.
+ */
+static const char *text;
+static size_t text_len;
+static size_t text_at;
+
+/*
+ * Compaction in progress: the file being written and the next line
+ * to write. Lines are written from the oldest (tail) to the newest.
+ */
+static FILE *compact_fp;
+static struct history *compact_at;
+static size_t compact_n;
+
+#ifndef COMPACT_SLACK
+#define COMPACT_SLACK 64
+#endif
+#ifndef COMPACT_CHUNK
+#define COMPACT_CHUNK 256
+#endif
+#ifndef LOAD_CHUNK
+#define LOAD_CHUNK 1024
+#endif
+
+/*
+ * Scoring of ranked completion. A line that begins with what was typed
+ * always ranks above one that only contains it as a subsequence.
+ */
+#define SCORE_PREFIX	1000
+#define SCORE_ADJACENT	8
+#define SCORE_WORD	6
+#define MAX_COMPLETE	16
+
+/*
+ * Lines and tree nodes are allocated in blocks of this many and never
+ * freed, so that loading a large history takes a handful of allocations.
+ */
+#define BLOCK_ITEMS 1024
 
 static char *file = ".cocowm_history";
 
 static const char *history_path();
-
-void history_save();
+static const char *compact_path();
+static void *block_alloc(char **, size_t *, size_t);
+static struct node *tree_walk(const char *, size_t, int, struct history *);
+static void tree_insert(struct history *);
+static struct history *history_index(const char *, size_t, int,
+    unsigned int);
+static size_t parse_uses(const char *, size_t, unsigned int *);
+static void write_line(FILE *, struct history *);
+static int load_chunk(size_t);
+static void load_rest();
+static void compact_begin();
+static int grow_lines();
+static uint64_t char_bit(unsigned char);
+static int frecency(struct history *);
+static int fuzzy_score(const char *, const char *, size_t, const char *,
+    size_t);
 
 static const char *
 history_path()
@@ -50,84 +154,452 @@ history_path()
 	return s;
 }
 
-const char *
-history_match(const char *s)
+static const char *
+compact_path()
 {
-	ssize_t i;
-	size_t best_pts = 0, pts;
-	const char *best_match = NULL, *p, *q;
-	struct history *h;
+	static char s[PATH_MAX];
+
+	if (snprintf(s, sizeof(s), "%s.tmp", history_path()) >= sizeof(s))
+		err(1, "history path name overflow");
+
+	return s;
+}
+
+static void *
+block_alloc(char **block, size_t *left, size_t size)
+{
+	void *p;
+
+	if (*left == 0) {
+		if ((*block = calloc(BLOCK_ITEMS, size)) == NULL)
+			err(1, "history");
+		*left = BLOCK_ITEMS;
+	}
+
+	p = *block;
+	*block += size;
+	(*left)--;
+
+	return p;
+}
+
+static struct node *
+node_new(const char *label, size_t len)
+{
+	static char *block;
+	static size_t left;
+	struct node *n;
+
+	n = block_alloc(&block, &left, sizeof(*n));
+	n->label = label;
+	n->len = len;
+
+	return n;
+}
+
+/*
+ * Walks down the tree along a string (s) of length (len). Returns the
+ * node where (s) ends, or NULL if no line starts with (s). If 'exact' is
+ * set, only a node where a line equal to (s) ends is returned. If
+ * 'touch' is not NULL, it is made the most recent line of every node on
+ * the way.
+ */
+static struct node *
+tree_walk(const char *s, size_t len, int exact, struct history *touch)
+{
+	struct node *n, *c;
+	size_t i;
+
+	n = &root;
+
+	if (touch != NULL)
+		n->recent = touch;
+
+	while (len > 0) {
+		for (c = n->child; c != NULL; c = c->sibling)
+			if (c->label[0] == s[0])
+				break;
+		if (c == NULL)
+			return NULL;
+
+		for (i = 1; i < c->len && i < len; i++)
+			if (c->label[i] != s[i])
+				return NULL;
 
-	if (s == NULL)
+		if (touch != NULL)
+			c->recent = touch;
+
+		if (len <= c->len) {
+			if (exact && (len != c->len || c->line == NULL))
+				return NULL;
+			return c;
+		}
+		s += c->len;
+		len -= c->len;
+		n = c;
+	}
+
+	if (exact && n->line == NULL)
 		return NULL;
+	return n;
+}
+
+/*
+ * Adds a line (h) that is not yet in the tree, as the most recent line.
+ */
+static void
+tree_insert(struct history *h)
+{
+	struct node *n, *c, *split;
+	const char *s;
+	size_t len, i;
+
+	n = &root;
+	n->recent = h;
+	s = h->line;
+	len = h->len;
 
-	if (head == NULL)
-		history_load();
-
-	for (h = head; h != NULL; h = h->next) {
-		q = s;
-		p = h->line;
-		pts = 0;
-		while (*p != '\0' && *q != '\0')
-			if (*p++ == *q++)
-				pts++;
-			else {
-				pts = 0;
+	while (len > 0) {
+		for (c = n->child; c != NULL; c = c->sibling)
+			if (c->label[0] == s[0])
 				break;
-			}
-		if (*p == '\0' && *q != '\0')
-			pts = 0;
-		if (pts > best_pts) {
-			best_pts = pts;
-			best_match = h->line;
+		if (c == NULL) {
+			c = node_new(s, len);
+			c->sibling = n->child;
+			n->child = c;
+			c->line = c->recent = h;
+			return;
 		}
+
+		for (i = 1; i < c->len && i < len; i++)
+			if (c->label[i] != s[i])
+				break;
+
+		/*
+		 * Diverges in the middle of the label, split the node so
+		 * that the common part is a node of its own.
+		 */
+		if (i < c->len) {
+			split = node_new(c->label + i, c->len - i);
+			split->child = c->child;
+			split->line = c->line;
+			split->recent = c->recent;
+			c->child = split;
+			c->len = i;
+			c->line = NULL;
+		}
+
+		c->recent = h;
+		s += i;
+		len -= i;
+		n = c;
 	}
 
-	return best_match;	
+	n->line = h;
 }
 
-void
-history_remove(const char *s)
+/*
+ * Returns the most recently used line that begins with (s) and sets
+ * its length to (len). The line is not necessarily NUL terminated.
+ */
+const char *
+history_match(const char *s, size_t *len)
 {
-	struct history *h;
+	struct node *n;
 
-	for (h = head; h != NULL; h = h->next)
-		if (strcmp(h->line, s) == 0)
-			break;
-	if (h == NULL)
-		return;
+	if (s == NULL || *s == '\0')
+		return NULL;
 
-	if (h->prev)
-		h->prev->next = h->next;
-	if (h->next)
-		h->next->prev = h->prev;
-	if (h == head)
-		head = h->next;
-	if (h == tail)
-		tail = h->prev;
+	load_rest();
+
+	if ((n = tree_walk(s, strlen(s), 0, NULL)) == NULL)
+		return NULL;
 
-	free(h->line);
-	free(h);
+	*len = n->recent->len;
+	return n->recent->line;
 }
 
-void
-history_add(const char *s)
+/*
+ * Steps from a line (*at), or from before the most recent line if
+ * NULL, to the next older (dir > 0) or newer (dir < 0) line that begins
+ * with (s) of length (len) and is longer than it. Sets (*at) to the line
+ * and (len) to its length, and returns it, or NULL if there is none.
+ */
+const char *
+history_walk(const struct history **at, int dir, const char *s,
+    size_t *len)
 {
-	struct history *h;
+	const struct history *h;
+
+	load_rest();
+
+	if (*at == NULL)
+		h = (dir > 0) ? head : NULL;
+	else
+		h = (dir > 0) ? (*at)->next : (*at)->prev;
+	for (; h != NULL; h = (dir > 0) ? h->next : h->prev)
+		if (h->len > *len && memcmp(h->line, s, *len) == 0) {
+			*at = h;
+			*len = h->len;
+			return h->line;
+		}
 
-	history_remove(s);
+	return NULL;
+}
 
-	h = calloc(1, sizeof(*h));
-	if (h == NULL) {
-		warn("saving history");
-		return;
+static int
+grow_lines()
+{
+	struct history **l;
+	uint64_t *m;
+	size_t max;
+
+	max = (lines_max == 0) ? BLOCK_ITEMS : lines_max * 2;
+
+	if ((l = realloc(lines, max * sizeof(*l))) == NULL) {
+		warn("history index");
+		return -1;
 	}
+	lines = l;
+	if ((m = realloc(masks, max * sizeof(*m))) == NULL) {
+		warn("history index");
+		return -1;
+	}
+	masks = m;
+	lines_max = max;
 
-	h->line = strdup(s);
-	if (h->line == NULL) {
-		free(h);
-		warn("strdup history");
-		return;
+	return 0;
+}
+
+static uint64_t
+char_bit(unsigned char c)
+{
+	c = tolower(c);
+
+	if (c >= 'a' && c <= 'z')
+		return 1ULL << (c - 'a');
+	if (c >= '0' && c <= '9')
+		return 1ULL << (26 + c - '0');
+
+	return 1ULL << (36 + c % 28);
+}
+
+/*
+ * Weighs how often a line (h) has been used by how recently, counted
+ * in uses of any line since.
+ */
+static int
+frecency(struct history *h)
+{
+	unsigned int age;
+	int uses;
+
+	age = seq - h->last;
+	uses = (h->uses < 64) ? h->uses : 64;
+
+	if (age < 16)
+		return uses * 8;
+	if (age < 256)
+		return uses * 4;
+	if (age < 4096)
+		return uses * 2;
+	return uses;
+}
+
+/*
+ * Scores how well a line (s) matches what was typed, given in both
+ * lower (lo) and upper case (up) of length (qlen). Characters typed
+ * must appear in (s) in order; adjacent ones and ones at the start of
+ * a word score more. Returns -1 if there is no match.
+ */
+static int
+fuzzy_score(const char *lo, const char *up, size_t qlen, const char *s,
+    size_t len)
+{
+	size_t i, j, last;
+	unsigned char c, fold;
+	int score;
+
+	score = 0;
+	last = 0;
+	for (i = j = 0; i < qlen; i++, j++) {
+		/*
+		 * Letters differ in case by one bit only, so one compare
+		 * per character does.
+		 */
+		c = lo[i];
+		fold = (c != (unsigned char) up[i]) ? 0x20 : 0;
+		while (j < len && ((unsigned char) s[j] | fold) != c)
+			j++;
+		if (j == len)
+			return -1;
+
+		if (i > 0 && j == last + 1)
+			score += SCORE_ADJACENT;
+		if (j == 0 || s[j - 1] == ' ' || s[j - 1] == '/' ||
+		    s[j - 1] == '-' || s[j - 1] == '.' || s[j - 1] == '_')
+			score += SCORE_WORD;
+		last = j;
+	}
+
+	return score;
+}
+
+/*
+ * Finds at most (k) lines that best match what was typed (s), ranked
+ * by how well they match and by frecency. Stores the lines and their
+ * lengths to (line) and (len), best first, and returns how many were
+ * found. The lines are not necessarily NUL terminated.
+ */
+int
+history_complete(const char *s, const char **line, size_t *len, int k)
+{
+	struct history *h, *top[MAX_COMPLETE];
+	int score[MAX_COMPLETE];
+	char lo[512], up[512];
+	uint64_t qmask;
+	size_t qlen, i;
+	int n, j, m, best, prefix;
+
+	if (s == NULL || *s == '\0')
+		return 0;
+
+	load_rest();
+
+	if (k > MAX_COMPLETE)
+		k = MAX_COMPLETE;
+
+	qlen = strlen(s);
+	if (qlen > sizeof(lo))
+		qlen = sizeof(lo);
+
+	qmask = 0;
+	for (i = 0; i < qlen; i++) {
+		qmask |= char_bit(s[i]);
+		lo[i] = tolower((unsigned char) s[i]);
+		up[i] = toupper((unsigned char) s[i]);
+	}
+	best = qlen * (SCORE_ADJACENT + SCORE_WORD);
+
+	n = 0;
+	for (i = 0; i < n_lines; i++) {
+		if ((masks[i] & qmask) != qmask)
+			continue;
+
+		h = lines[i];
+		prefix = (qlen <= h->len && memcmp(s, h->line, qlen) == 0);
+
+		/*
+		 * Can't make it to the top even with a perfect match?
+		 * On a tie, the more recent line wins as below.
+		 */
+		m = frecency(h);
+		if (n == k) {
+			j = m + best + (prefix ? SCORE_PREFIX : 0);
+			if (j < score[k - 1] || (j == score[k - 1] &&
+			    top[k - 1]->last > h->last))
+				continue;
+		}
+
+		if (prefix)
+			m += SCORE_PREFIX + best;
+		else if ((j = fuzzy_score(lo, up, qlen, h->line, h->len)) >= 0)
+			m += j;
+		else
+			continue;
+
+		/*
+		 * Insert in order, more recent first among equals.
+		 */
+		for (j = n; j > 0; j--) {
+			if (score[j - 1] > m || (score[j - 1] == m &&
+			    top[j - 1]->last > h->last))
+				break;
+			if (j < k) {
+				score[j] = score[j - 1];
+				top[j] = top[j - 1];
+			}
+		}
+		if (j < k) {
+			score[j] = m;
+			top[j] = h;
+			if (n < k)
+				n++;
+		}
+	}
+
+	for (j = 0; j < n; j++) {
+		line[j] = top[j]->line;
+		len[j] = top[j]->len;
+	}
+
+	return n;
+}
+
+/*
+ * Makes a line (s) of length (len) the most recent line in memory,
+ * used (uses) times in all, or once more if zero. If 'copy' is set,
+ * the line is copied if it is new, otherwise it must stay around.
+ * Returns NULL if it could not be added.
+ */
+static struct history *
+history_index(const char *s, size_t len, int copy, unsigned int uses)
+{
+	static char *block;
+	static size_t left;
+	struct node *n;
+	struct history *h;
+	char *q;
+	size_t i;
+
+	if ((n = tree_walk(s, len, 1, NULL)) != NULL) {
+		h = n->line;
+		h->uses = (uses > 0) ? uses : h->uses + 1;
+		h->last = ++seq;
+		if (h == head)
+			return h;
+
+		/*
+		 * Already known, only move it to the front. If it is
+		 * next in line for compaction, it gets written when
+		 * compaction reaches the front.
+		 */
+		if (h == compact_at)
+			compact_at = h->prev;
+		h->prev->next = h->next;
+		if (h->next)
+			h->next->prev = h->prev;
+		if (h == tail)
+			tail = h->prev;
+		h->prev = NULL;
+
+		tree_walk(s, len, 1, h);
+	} else {
+		if (n_lines == lines_max && grow_lines() == -1)
+			return NULL;
+
+		if (copy) {
+			if ((q = malloc(len + 1)) == NULL) {
+				warn("saving history");
+				return NULL;
+			}
+			memcpy(q, s, len);
+			q[len] = '\0';
+			s = q;
+		}
+
+		h = block_alloc(&block, &left, sizeof(*h));
+		h->line = s;
+		h->len = len;
+		h->uses = (uses > 0) ? uses : 1;
+		h->last = ++seq;
+
+		tree_insert(h);
+
+		masks[n_lines] = 0;
+		for (i = 0; i < len; i++)
+			masks[n_lines] |= char_bit(s[i]);
+		lines[n_lines++] = h;
 	}
 
 	h->next = head;
@@ -137,52 +609,241 @@ history_add(const char *s)
 	if (tail == NULL)
 		tail = h;
 
-	history_save();
+	return h;
+}
+
+/*
+ * Reads the number of uses a line (s) of length (len) may begin with,
+ * as in ": 12;make" for "make" used 12 times. Sets (uses) to it, or to
+ * zero if there is none, and returns the length of the prefix.
+ */
+static size_t
+parse_uses(const char *s, size_t len, unsigned int *uses)
+{
+	unsigned int n;
+	size_t i;
+
+	*uses = 0;
+	if (len < 4 || s[0] != ':' || s[1] != ' ' ||
+	    !isdigit((unsigned char) s[2]))
+		return 0;
+
+	n = 0;
+	for (i = 2; i < len && isdigit((unsigned char) s[i]); i++)
+		if (n < UINT_MAX / 10)
+			n = n * 10 + (s[i] - '0');
+	if (i == len || s[i] != ';' || n == 0)
+		return 0;
+
+	*uses = n;
+	return i + 1;
+}
+
+/*
+ * Writes a line (h) to a history file, with its number of uses unless
+ * it has been used only once, so that frequency is not lost when the
+ * file is compacted. A line that looks like it had the number already
+ * always gets it.
+ */
+static void
+write_line(FILE *fp, struct history *h)
+{
+	unsigned int uses;
+
+	if (h->uses > 1 || parse_uses(h->line, h->len, &uses) > 0)
+		fprintf(fp, ": %u;", h->uses);
+	fprintf(fp, "%.*s\n", (int) h->len, h->line);
 }
 
+/*
+ * Adds a line (s) to the history. The history file is a journal that
+ * is only appended to; a line that is used again is appended again with
+ * its number of uses, and the latest occurrence counts when loading.
+ * Once the duplicates make up more than half of the file, it is
+ * compacted in the background.
+ */
 void
-history_load()
+history_add(const char *s)
 {
+	struct history *h;
 	FILE *fp;
-	char *line = NULL;
-	size_t sz = 0;
-	ssize_t len;
-	const char *s;
+	const char *path;
+	size_t len;
+	int c;
 
-	s = history_path();
-	fp = fopen(s, "r");
-	if (fp == NULL) {
-		warnx("fopen history for reading");
+	load_rest();
+
+	len = strlen(s);
+	if ((h = history_index(s, len, 1, 0)) == NULL)
+		return;
+
+	path = history_path();
+	if ((fp = fopen(path, "a+")) == NULL) {
+		warn("fopen %s for appending", path);
 		return;
 	}
 
-	while ((len = getline(&line, &sz, fp)) > 0) {
-		line[strcspn(line, "\r\n")] = '\0';
-		history_add(line);
+	/* A last line without a newline is not joined with this one */
+	if (fseek(fp, -1, SEEK_END) == 0) {
+		c = fgetc(fp);
+		fseek(fp, 0, SEEK_END);
+		if (c != EOF && c != '\n')
+			fputc('\n', fp);
 	}
+	write_line(fp, h);
 	if (ferror(fp))
-		warnx("getline %s", s);
+		warn("%s", path);
+	fclose(fp);
 
-	if (line != NULL)
-		free(line);
+	n_journal++;
+	compact_begin();
 }
 
+/*
+ * Reads the history file for indexing. The lines are indexed a chunk
+ * at a time by history_idle(), or all at once when the history is
+ * first needed before that has finished.
+ */
 void
-history_save()
+history_load()
 {
-	FILE *fp;
-	struct history *h;
+	struct stat st;
 	const char *s;
+	char *p;
+	size_t len;
+	ssize_t n;
+	int fd;
+
+	if (loaded)
+		return;
+	loaded = 1;
 
 	s = history_path();
-	fp = fopen(s, "w");
-	if (fp == NULL)
-		err(1, "fopen history for writing");
+	if ((fd = open(s, O_RDONLY)) == -1) {
+		warnx("open history for reading");
+		return;
+	}
 
-	for (h = tail; h != NULL; h = h->prev)
-		fprintf(fp, "%s\n", h->line);
+	if (fstat(fd, &st) == -1)
+		warn("fstat %s", s);
+	else if (st.st_size > 0) {
+		if ((p = malloc(st.st_size)) == NULL)
+			warn("history");
+		else {
+			for (len = 0; len < st.st_size; len += n) {
+				n = read(fd, p + len, st.st_size - len);
+				if (n == -1)
+					warn("read %s", s);
+				if (n <= 0)
+					break;
+			}
+			text = p;
+			text_len = len;
+		}
+	}
 
-	if (ferror(fp))
-		warn("%s", s);
-	fclose(fp);
+	close(fd);
+}
+
+/*
+ * Indexes at most (n) more lines of the history file read. Returns 1
+ * if there are lines left.
+ */
+static int
+load_chunk(size_t n)
+{
+	const char *line, *nl;
+	unsigned int uses;
+	size_t len, i;
+
+	while (n-- > 0 && text_at < text_len) {
+		line = &text[text_at];
+		nl = memchr(line, '\n', text_len - text_at);
+		len = (nl != NULL) ? (size_t) (nl - line) : text_len - text_at;
+		text_at += len + 1;
+
+		if (len > 0 && line[len - 1] == '\r')
+			len--;
+		i = parse_uses(line, len, &uses);
+		history_index(line + i, len - i, 0, uses);
+		n_journal++;
+	}
+
+	if (text_at < text_len)
+		return 1;
+
+	compact_begin();
+	return 0;
+}
+
+static void
+load_rest()
+{
+	history_load();
+	while (load_chunk(SIZE_MAX))
+		;
+}
+
+/*
+ * Starts rewriting the history file without duplicates if they have
+ * started to dominate it. The work is done by history_idle().
+ */
+static void
+compact_begin()
+{
+	if (compact_fp != NULL || n_journal <= 2 * n_lines + COMPACT_SLACK)
+		return;
+
+	if ((compact_fp = fopen(compact_path(), "w")) == NULL) {
+		warn("fopen %s", compact_path());
+		return;
+	}
+
+	TRACE("compacting history of %zu lines to %zu", n_journal, n_lines);
+	compact_at = tail;
+	compact_n = 0;
+}
+
+/*
+ * Does background work in small steps so that the window manager is
+ * never blocked for long: first indexes the history file, then
+ * compacts it if needed, oldest lines first. Lines used while
+ * compacting are moved to the front and are thus still written.
+ * Call when there are no events to handle. Returns 1 if there is more
+ * work to do.
+ */
+int
+history_idle()
+{
+	int i;
+
+	if (loaded && text_at < text_len)
+		return load_chunk(LOAD_CHUNK) || compact_fp != NULL;
+
+	if (compact_fp == NULL)
+		return 0;
+
+	for (i = 0; i < COMPACT_CHUNK && compact_at != NULL; i++) {
+		write_line(compact_fp, compact_at);
+		compact_at = compact_at->prev;
+		compact_n++;
+	}
+	if (compact_at != NULL)
+		return 1;
+
+	if (fflush(compact_fp) != 0 || ferror(compact_fp)) {
+		warn("%s", compact_path());
+		fclose(compact_fp);
+		unlink(compact_path());
+	} else {
+		fclose(compact_fp);
+		if (rename(compact_path(), history_path()) == -1) {
+			warn("rename %s", compact_path());
+			unlink(compact_path());
+		} else
+			n_journal = compact_n;
+	}
+	compact_fp = NULL;
+
+	return 0;
 }
@@ -3,6 +3,8 @@
 #include <X11/keysym.h>
 
 #include <err.h>
+#include <limits.h>
+#include <stdio.h>
 
 #define DONT_CHECK_MASK -1
 
@@ -48,6 +50,7 @@ static const struct binding keybinding[] = {
 
 /* Window manager */
 	{ XK_F11,   0,                       RestartManager, 0 },
+	{ XK_F11,   ShiftMask,               ReloadKeys,     0 },
 	{ XK_F12,   0,                       QuitManager,    0 },
 	{ 0 }
 };
@@ -84,9 +87,82 @@ static const struct binding modebind[] = {
 static int _mode;
 #endif
 
-static void _unbind_keys(Display *, Window, const struct binding *);
-static void _bind_keys(Display *, Window, const struct binding *);
-static int _find_binding(XKeyEvent *, int *target, const struct binding *);
+/*
+ * Bindings in use, the defaults above with those of the user file on
+ * top, in a hash table by keysym and modifiers. A binding to NoAction
+ * takes a default binding away.
+ */
+#ifndef KEY_SLOTS
+#define KEY_SLOTS 256		/* Power of two */
+#endif
+
+struct keytable {
+	struct binding slot[KEY_SLOTS];
+	int n;
+};
+
+static struct keytable keys;
+#ifdef STICKYKEYS
+static struct keytable modekeys;
+#endif
+
+static char *file = ".cocowm_keys";
+
+/*
+ * The bindings grabbed, resolved to the keycodes that give their keysym
+ * when no modifiers are down, so a key event is looked up by its
+ * keycode alone. Lock and NumLock are left out of the modifiers
+ * compared, and keys are grabbed with and without them.
+ */
+struct resolved {
+	int modifiermask;
+	int op;
+	int target;
+	struct resolved *next;
+};
+
+#ifndef RESOLVED_MAX
+#define RESOLVED_MAX (2 * KEY_SLOTS)
+#endif
+
+static struct resolved *bycode[256];
+static struct resolved resolved[RESOLVED_MAX];
+static const struct keytable *grabbed;
+static unsigned int lock_masks[4];
+static int n_lock_masks;
+static unsigned int ignored_mask;
+
+#define CHECKED_MASK (ShiftMask | LockMask | ControlMask | Mod1Mask | \
+	Mod2Mask | Mod3Mask | Mod4Mask | Mod5Mask)
+
+/*
+ * Actions are done when their key is pressed. A held key repeats the
+ * actions that step through the layout, and the others only once.
+ */
+#ifndef KEY_REPEAT
+#define KEY_REPEAT 1
+#endif
+
+#ifndef KEY_REPEAT_MS
+#define KEY_REPEAT_MS 1000	/* Longer than any repeat delay */
+#endif
+
+static unsigned int held;		/* Keycode down, or 0 */
+static Time held_time;
+
+#define KEY_HASH(sym, mask) \
+	((((unsigned long) (sym) * 2654435761UL) ^ (unsigned int) (mask)) & \
+	(KEY_SLOTS - 1))
+
+static void _unbind_keys(Display *, Window);
+static void _bind_keys(Display *, Window, const struct keytable *);
+static void find_lock_masks(Display *);
+static int repeats(int);
+static struct binding *lookup(const struct keytable *, KeySym, int);
+static void add_binding(struct keytable *, const struct binding *);
+static void load_bindings(struct keytable *, const struct binding *);
+static void read_bindings(struct keytable *);
+static int parse_binding(char *, struct binding *);
 
 #include <stdlib.h>
 
@@ -97,106 +173,419 @@ void toggle_keybind_mode(Display *display)
 	_mode ^= 1;
 	TRACE("togglemode now %d", _mode);
 	if (_mode == 1) {
-		_unbind_keys(display, DefaultRootWindow(display), modebind);
+		_unbind_keys(display, DefaultRootWindow(display));
 		bind_keys(display, DefaultRootWindow(display));
 		system("xsetroot -solid red");
 	} else {
 		unbind_keys(display, DefaultRootWindow(display));
-		_bind_keys(display, DefaultRootWindow(display), modebind);
+		_bind_keys(display, DefaultRootWindow(display), &modekeys);
 		system("xsetroot -solid black");
 	}
 }
 #endif
 
+/*
+ * Finds the action of a key (xkey). A binding for the exact modifiers
+ * wins over one for any modifiers.
+ */
 int
 find_binding(XKeyEvent *xkey, int *target)
 {
-#ifdef STICKYKEYS
-	if (_mode == 0) {
-		TRACE("finding modebind");
-		return _find_binding(xkey, target, modebind);
-	}
-#endif
+	const struct resolved *r, *any;
+	int mask;
 
-	TRACE("finding keybinding");
-	return _find_binding(xkey, target, keybinding);
+	if (xkey->keycode >= sizeof(bycode) / sizeof(bycode[0]))
+		return -1;
+
+	mask = xkey->state & CHECKED_MASK & ~ignored_mask;
+	any = NULL;
+	for (r = bycode[xkey->keycode]; r != NULL; r = r->next)
+		if (r->modifiermask == mask)
+			break;
+		else if (r->modifiermask == DONT_CHECK_MASK && any == NULL)
+			any = r;
+	if (r == NULL && (r = any) == NULL)
+		return -1;
+
+	*target = r->target;
+	return r->op;
 }
 
 static int
-_find_binding(XKeyEvent *xkey, int *target, const struct binding *bindings)
+repeats(int op)
+{
+	return step_action(op) ? KEY_REPEAT : 0;
+}
+
+/*
+ * A key (e) with an action (op) was pressed. Returns how many times
+ * the action is to be done: 0 if it is a repeat of an action that does
+ * not repeat, or else one more than the number of repeats of the key
+ * already queued, which are taken off the queue.
+ *
+ * Repeats are told apart by the key not having been released, as with
+ * detectable auto-repeat there are no releases between them, see
+ * main().
+ */
+int
+key_press(Display *display, XKeyEvent *e, int op)
+{
+	XEvent next;
+	int n;
+
+	/* A release may have gone elsewhere, e.g. during a grab */
+	if (e->keycode != held || e->time - held_time > KEY_REPEAT_MS) {
+		held = e->keycode;
+		held_time = e->time;
+		return 1;
+	}
+	held_time = e->time;
+	if (!repeats(op))
+		return 0;
+
+	for (n = 1; XEventsQueued(display, QueuedAlready) > 0; n++) {
+		XPeekEvent(display, &next);
+		if (next.type != KeyPress || next.xkey.keycode != held ||
+		    next.xkey.state != e->state)
+			break;
+		XNextEvent(display, &next);
+		held_time = next.xkey.time;
+	}
+	if (n > 1)
+		TRACE("%d key repeats at once", n);
+
+	return n;
+}
+
+/*
+ * A key (e) was released. Without detectable auto-repeat, a repeat is
+ * a release followed by a press at the same time, which keeps the key
+ * held.
+ */
+void
+key_release(Display *display, XKeyEvent *e)
+{
+	XEvent next;
+
+	if (e->keycode != held)
+		return;
+	if (XEventsQueued(display, QueuedAfterReading) > 0) {
+		XPeekEvent(display, &next);
+		if (next.type == KeyPress && next.xkey.keycode == held &&
+		    next.xkey.time == e->time)
+			return;
+	}
+	held = 0;
+}
+
+static struct binding *
+lookup(const struct keytable *kt, KeySym sym, int mask)
 {
-	int                   i, mask;
-	KeySym                sym;
 	const struct binding *kb;
+	unsigned long i;
+
+	for (i = KEY_HASH(sym, mask); (kb = &kt->slot[i])->keysym != 0;
+	    i = (i + 1) & (KEY_SLOTS - 1))
+		if (kb->keysym == sym && kb->modifiermask == mask)
+			return (struct binding *) kb;
+
+	return NULL;
+}
+
+/*
+ * Adds a binding (b) to a table (kt), or replaces the one of the same
+ * key and modifiers.
+ */
+static void
+add_binding(struct keytable *kt, const struct binding *b)
+{
+	struct binding *kb;
+	unsigned long i;
+
+	if ((kb = lookup(kt, b->keysym, b->modifiermask)) != NULL) {
+		*kb = *b;
+		return;
+	}
 
-	sym = XLookupKeysym(xkey, 0);
-	mask = xkey->state;
-	for (i = 0; bindings[i].keysym != 0; i++) {
-		kb = &(bindings[i]);
-		TRACE("checking binding sym vs sym %d %d", (int) kb->keysym, (int) sym);
-		TRACE("checking mask vs mask %d %d", (int) kb->modifiermask, (int) mask);
-		if (kb->keysym == sym &&
-		   (kb->modifiermask == mask ||
-		   kb->modifiermask == DONT_CHECK_MASK)) {
-			*target = kb->target;
-			return kb->op;
+	/* Keep a free slot so that lookups end */
+	if (kt->n == KEY_SLOTS - 1) {
+		warnx("too many key bindings");
+		return;
+	}
+	for (i = KEY_HASH(b->keysym, b->modifiermask);
+	    kt->slot[i].keysym != 0; i = (i + 1) & (KEY_SLOTS - 1))
+		;
+	kt->slot[i] = *b;
+	kt->n++;
+}
+
+static void
+load_bindings(struct keytable *kt, const struct binding *bindings)
+{
+	int i;
+
+	memset(kt, 0, sizeof(*kt));
+	for (i = 0; bindings[i].keysym != 0; i++)
+		add_binding(kt, &bindings[i]);
+}
+
+/*
+ * Parses a line (s) of the key binding file, e.g.
+ *
+ *	Mod4+Control+Right MoveColumn Forward
+ *
+ * Modifiers are Shift, Control, Mod1 to Mod5, or Any for a key whose
+ * modifiers are not checked. Returns 0 if (s) has a binding.
+ */
+static int
+parse_binding(char *s, struct binding *b)
+{
+	static const struct {
+		const char *name;
+		int mask;
+	} mods[] = {
+		{ "Shift", ShiftMask }, { "Control", ControlMask },
+		{ "Ctrl", ControlMask }, { "Mod1", Mod1Mask },
+		{ "Alt", Mod1Mask }, { "Mod2", Mod2Mask },
+		{ "Mod3", Mod3Mask }, { "Mod4", Mod4Mask },
+		{ "Super", Mod4Mask }, { "Mod5", Mod5Mask },
+		{ "Any", DONT_CHECK_MASK }, { NULL }
+	};
+	char *key, *op, *target, *mod, *next, *last;
+	int i;
+
+	if ((key = strtok_r(s, " \t\n", &last)) == NULL || *key == '#')
+		return -1;
+	op = strtok_r(NULL, " \t\n", &last);
+	target = strtok_r(NULL, " \t\n", &last);
+	if (op == NULL) {
+		warnx("%s: no action for %s", file, key);
+		return -1;
+	}
+
+	b->modifiermask = 0;
+	for (mod = key; (next = strchr(mod, '+')) != NULL; mod = next + 1) {
+		*next = '\0';
+		for (i = 0; mods[i].name != NULL; i++)
+			if (strcmp(mods[i].name, mod) == 0)
+				break;
+		if (mods[i].name == NULL) {
+			warnx("%s: unknown modifier %s", file, mod);
+			return -1;
+		}
+		if (mods[i].mask == DONT_CHECK_MASK)
+			b->modifiermask = DONT_CHECK_MASK;
+		else if (b->modifiermask != DONT_CHECK_MASK)
+			b->modifiermask |= mods[i].mask;
+	}
+	if ((b->keysym = XStringToKeysym(mod)) == NoSymbol) {
+		warnx("%s: unknown key %s", file, mod);
+		return -1;
+	}
+
+	for (b->op = 0; str_op(b->op) != NULL; b->op++)
+		if (strcmp(str_op(b->op), op) == 0)
+			break;
+	if (str_op(b->op) == NULL) {
+		warnx("%s: unknown action %s", file, op);
+		return -1;
+	}
+
+	b->target = NoTarget;
+	if (target != NULL) {
+		for (b->target = 0; str_target(b->target) != NULL;
+		    b->target++)
+			if (strcmp(str_target(b->target), target) == 0)
+				break;
+		if (str_target(b->target) == NULL) {
+			warnx("%s: unknown target %s", file, target);
+			return -1;
 		}
 	}
 
-	warnx("binding not found");
-	return -1;
+	return 0;
 }
 
+/*
+ * Reads the bindings of the user to a table (kt), if there are any.
+ */
 static void
-_bind_keys(Display *display, Window root, const struct binding *bindings)
+read_bindings(struct keytable *kt)
 {
-	int i, code, mask, mouse, kbd;
-	Bool owner_events;
+	struct binding b;
+	const char *home;
+	char path[PATH_MAX], line[256];
+	FILE *fp;
 
-	for (i = 0; bindings[i].keysym != 0; i++) {
-		code = XKeysymToKeycode(display, bindings[i].keysym);
-		if (bindings[i].modifiermask == DONT_CHECK_MASK)
-			mask = 0;
-		else
-			mask = bindings[i].modifiermask;
-		mouse = GrabModeSync;
-		kbd = GrabModeAsync;
-		owner_events = False;
-		XGrabKey(display, code, mask, root, owner_events, mouse, kbd);
+	if ((home = getenv("HOME")) == NULL)
+		home = "/";
+	if (snprintf(path, sizeof(path), "%s/%s", home, file) >=
+	    sizeof(path)) {
+		warnx("key binding path name overflow");
+		return;
 	}
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (parse_binding(line, &b) == 0)
+			add_binding(kt, &b);
+	fclose(fp);
+
+	TRACE("%d key bindings", kt->n);
 }
 
+/*
+ * Finds the modifiers that Lock and NumLock are on.
+ */
 static void
-_unbind_keys(Display *display, Window root, const struct binding *bindings)
+find_lock_masks(Display *display)
 {
-	int i, code, mask;
+	XModifierKeymap *mods;
+	KeyCode numlock;
+	unsigned int num;
+	int i;
+
+	num = 0;
+	numlock = XKeysymToKeycode(display, XK_Num_Lock);
+	if ((mods = XGetModifierMapping(display)) != NULL) {
+		for (i = 0; i < 8 * mods->max_keypermod; i++)
+			if (numlock != 0 && mods->modifiermap[i] == numlock)
+				num = 1 << (i / mods->max_keypermod);
+		XFreeModifiermap(mods);
+	}
 
-	for (i = 0; bindings[i].keysym != 0; i++) {
-		code = XKeysymToKeycode(display, bindings[i].keysym);
-		if (bindings[i].modifiermask == DONT_CHECK_MASK)
-			mask = 0;
-		else
-			mask = bindings[i].modifiermask;
-		XUngrabKey(display, code, mask, root);
+	ignored_mask = LockMask | num;
+	n_lock_masks = 0;
+	lock_masks[n_lock_masks++] = 0;
+	lock_masks[n_lock_masks++] = LockMask;
+	if (num != 0 && num != LockMask) {
+		lock_masks[n_lock_masks++] = num;
+		lock_masks[n_lock_masks++] = num | LockMask;
 	}
 }
 
+/*
+ * Grabs the keys of bindings in a table (kt), and resolves them to
+ * keycodes for find_binding().
+ */
+static void
+_bind_keys(Display *display, Window root, const struct keytable *kt)
+{
+	int i, j, min, max, per, code, mask, n;
+	KeySym *map;
+	const struct binding *kb;
+	struct resolved *r;
+
+	find_lock_masks(display);
+	XDisplayKeycodes(display, &min, &max);
+	if ((map = XGetKeyboardMapping(display, min, max - min + 1,
+	    &per)) == NULL)
+		return;
+
+	memset(bycode, 0, sizeof(bycode));
+	n = 0;
+	for (i = 0; i < KEY_SLOTS; i++) {
+		kb = &kt->slot[i];
+		if (kb->keysym == 0 || kb->op == NoAction)
+			continue;
+		for (code = min; code <= max; code++) {
+			if (map[(code - min) * per] != kb->keysym)
+				continue;
+			if (n == RESOLVED_MAX) {
+				warnx("too many key bindings");
+				break;
+			}
+
+			r = &resolved[n++];
+			r->modifiermask = kb->modifiermask;
+			r->op = kb->op;
+			r->target = kb->target;
+			r->next = bycode[code];
+			bycode[code] = r;
+
+			if (kb->modifiermask == DONT_CHECK_MASK)
+				mask = 0;
+			else
+				mask = kb->modifiermask;
+			for (j = 0; j < n_lock_masks; j++)
+				XGrabKey(display, code, mask | lock_masks[j],
+				    root, False, GrabModeSync, GrabModeAsync);
+		}
+	}
+	XFree(map);
+	grabbed = kt;
+
+	TRACE("%d keys grabbed", n);
+}
+
+static void
+_unbind_keys(Display *display, Window root)
+{
+	XUngrabKey(display, AnyKey, AnyModifier, root);
+	memset(bycode, 0, sizeof(bycode));
+}
+
 void
 unbind_keys(Display *display, Window root)
 {
-	_unbind_keys(display, root, keybinding);
+	_unbind_keys(display, root);
 }
 
 void
 bind_keys(Display *display, Window root)
 {
-	_bind_keys(display, root, keybinding);
+	if (keys.n == 0) {
+		load_bindings(&keys, keybinding);
+		read_bindings(&keys);
+	}
+	_bind_keys(display, root, &keys);
+}
+
+/*
+ * Reads the key binding file again, without restarting.
+ */
+void
+reload_keys(Display *display)
+{
+	Window root = DefaultRootWindow(display);
+
+#ifdef STICKYKEYS
+	if (_mode == 1)
+#endif
+		unbind_keys(display, root);
+	load_bindings(&keys, keybinding);
+	read_bindings(&keys);
+#ifdef STICKYKEYS
+	if (_mode == 1)
+#endif
+		_bind_keys(display, root, &keys);
+}
+
+/*
+ * Keycodes or modifiers have changed, so the keys are grabbed and
+ * resolved again.
+ */
+void
+remap_keys(XMappingEvent *e)
+{
+	Window root = DefaultRootWindow(e->display);
+
+	XRefreshKeyboardMapping(e);
+	if (e->request == MappingPointer || grabbed == NULL)
+		return;
+
+	TRACE("keyboard mapping changed");
+	_unbind_keys(e->display, root);
+	_bind_keys(e->display, root, grabbed);
 }
 
 #ifdef STICKYKEYS
 void
 bind_mode_keys(Display *display, Window root)
 {
-	_bind_keys(display, root, modebind);
+	if (modekeys.n == 0)
+		load_bindings(&modekeys, modebind);
+	_bind_keys(display, root, &modekeys);
 }
 #endif
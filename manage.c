@@ -48,12 +48,34 @@ manage_pane(struct pane *p, struct column *c, struct pane *a)
 	assert(p != c->first || p->prev == NULL);
 
 	resize_relayout(c);
+	control_event("move 0x%lx %d", p->window, column_index(c));
 
 	TRACE_END("add to column done for pane %ld (after %ld)",
 	          PANE_NUMBER(p), PANE_NUMBER(a));
 	dump_column(c);
 }
 
+/*
+ * Appends pane (p) to the bottom of a column (c) as it is, without
+ * making room for it. The column is relaid out once all of its panes
+ * are in, see session_restore().
+ */
+void
+append_pane(struct pane *p, struct column *c)
+{
+	assert(p->column == NULL);
+
+	p->column = c;
+	p->next = NULL;
+	p->prev = c->last;
+	if (c->last != NULL)
+		c->last->next = p;
+	else
+		c->first = p;
+	c->last = p;
+	c->n++;
+}
+
 /*
  * Removes a pane (p) from its column.
  * Practically the pane will be orphan and not referenced until re-added.
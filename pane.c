@@ -71,7 +71,6 @@ void
 focus_pane(struct pane *p, struct layout *l)
 {
 	XGCValues v;
-	static unsigned int return_priority;
 
 	TRACE_BEGIN("focus_pane %s", PANE_STR(p));
 
@@ -79,6 +78,8 @@ focus_pane(struct pane *p, struct layout *l)
 
 	if (l->focus != NULL && l->focus != p) {
 		l->focus->flags &= ~PF_FOCUSED;
+		if (l->focus->flags & PF_EDIT)
+			prompt_focus(&l->focus->prompt, 0);
 
 		XGetGCValues(l->display, l->normal_gc, GCBackground, &v);
 		XSetWindowBackground(l->display, l->focus->frame,
@@ -91,10 +92,12 @@ focus_pane(struct pane *p, struct layout *l)
 		XGetGCValues(l->display, l->focus_gc, GCBackground, &v);
 		XSetWindowBackground(l->display, p->frame, v.background);
 
-		if (p->flags & PF_WITHOUT_WINDOW) {
+		if (p->flags & (PF_WITHOUT_WINDOW | PF_EDIT)) {
 			TRACE("forcing focus to frame");
 			XSetInputFocus(l->display, p->frame,
 			               RevertToPointerRoot, CurrentTime);
+			if (p->flags & PF_EDIT)
+				prompt_focus(&p->prompt, 1);
 		} else if (p->flags & PF_HAS_TAKEFOCUS) {
 			TRACE("Sending takefocus");
 			send_take_focus(p, l->display);
@@ -107,13 +110,15 @@ focus_pane(struct pane *p, struct layout *l)
 
 		l->column = p->column;
 
-		p->return_priority = return_priority++;
+		p->return_priority = l->return_priority++;
+		control_event("focus 0x%lx", p->window);
 		if (p->return_priority == 0) {	/* Wraparound */
 			/* TODO: Handle wraparound */
 		}
 	}
 
 	l->focus = p;
+	ewmh_focus((p != NULL) ? p->window : None);
 
 	assert(l->column != NULL);
 
@@ -0,0 +1,278 @@
+/*
+ * cocowm - Column Commander Window Manager for X11 Window System
+ * Copyright (c) 2023, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Index of the executables found in $PATH, for completing the command
+ * in the prompt. Directories are read a few entries at a time while
+ * there are no events waiting, see path_idle(), and read again when
+ * their modification time changes.
+ */
+
+#include "extern.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <sys/stat.h>
+
+struct pathdir {
+	char *name;
+	time_t mtime;		/* When last read */
+	struct pathdir *next;
+};
+
+static struct pathdir *dirs;
+
+/*
+ * The index in use, sorted and without duplicates, and the one being
+ * built, which replaces it when all directories have been read. Names
+ * found are copied by the prompt, see edit_step(), so the index
+ * replaced can go at once.
+ */
+static char **names;
+static size_t n_names;
+static char **scan;
+static size_t n_scan;
+static size_t scan_max;
+
+static struct pathdir *scan_dir;	/* Directory being read */
+static DIR *scan_dp;
+static int scanning;
+
+#ifndef PATH_CHUNK
+#define PATH_CHUNK 64
+#endif
+
+static int path_dirs();
+static int scan_add(const char *);
+static void scan_done();
+static void free_names(char **, size_t);
+static int compare_names(const void *, const void *);
+
+/*
+ * Splits $PATH to directories, once.
+ */
+static int
+path_dirs()
+{
+	struct pathdir *d, **tail;
+	const char *path;
+	char *s, *p, *last;
+
+	if ((path = getenv("PATH")) == NULL)
+		path = "/usr/bin:/bin";
+	if ((s = strdup(path)) == NULL) {
+		warn("path index");
+		return -1;
+	}
+
+	tail = &dirs;
+	for (p = strtok_r(s, ":", &last); p != NULL;
+	    p = strtok_r(NULL, ":", &last)) {
+		if ((d = calloc(1, sizeof(*d))) == NULL ||
+		    (d->name = strdup(p)) == NULL) {
+			warn("path index");
+			free(d);
+			break;
+		}
+		*tail = d;
+		tail = &d->next;
+	}
+	free(s);
+
+	return 0;
+}
+
+/*
+ * Starts reading $PATH again if any of its directories have changed
+ * since they were last read. Cheap enough to call whenever the index
+ * is about to be needed.
+ */
+void
+path_refresh()
+{
+	struct pathdir *d;
+	struct stat st;
+
+	if (scanning)
+		return;
+	if (dirs == NULL && path_dirs() == -1)
+		return;
+
+	for (d = dirs; d != NULL; d = d->next) {
+		if (stat(d->name, &st) == -1)
+			st.st_mtime = 0;
+		if (st.st_mtime != d->mtime)
+			break;
+	}
+	if (d == NULL)
+		return;
+
+	TRACE("path index: '%s' changed", d->name);
+	scan_dir = dirs;
+	scanning = 1;
+}
+
+/*
+ * Reads some directory entries to the index being built. Returns
+ * non-zero if there is more to do.
+ */
+int
+path_idle()
+{
+	struct dirent *de;
+	struct stat st;
+	int i;
+
+	if (!scanning)
+		return 0;
+
+	for (i = 0; i < PATH_CHUNK; i++) {
+		if (scan_dir == NULL) {
+			scan_done();
+			return 0;
+		}
+		if (scan_dp == NULL) {
+			if (stat(scan_dir->name, &st) == -1)
+				st.st_mtime = 0;
+			scan_dir->mtime = st.st_mtime;
+			if ((scan_dp = opendir(scan_dir->name)) == NULL) {
+				scan_dir = scan_dir->next;
+				continue;
+			}
+		}
+		if ((de = readdir(scan_dp)) == NULL) {
+			closedir(scan_dp);
+			scan_dp = NULL;
+			scan_dir = scan_dir->next;
+			continue;
+		}
+		if (de->d_name[0] == '.')
+			continue;
+		if (fstatat(dirfd(scan_dp), de->d_name, &st, 0) == -1 ||
+		    !S_ISREG(st.st_mode) ||
+		    !(st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+			continue;
+		if (scan_add(de->d_name) == -1) {
+			closedir(scan_dp);
+			scan_dp = NULL;
+			free_names(scan, n_scan);
+			scan = NULL;
+			n_scan = scan_max = 0;
+			scanning = 0;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+scan_add(const char *name)
+{
+	char **s;
+	size_t max;
+
+	if (n_scan == scan_max) {
+		max = (scan_max > 0) ? scan_max * 2 : 1024;
+		if ((s = realloc(scan, max * sizeof(*s))) == NULL) {
+			warn("path index");
+			return -1;
+		}
+		scan = s;
+		scan_max = max;
+	}
+	if ((scan[n_scan] = strdup(name)) == NULL) {
+		warn("path index");
+		return -1;
+	}
+	n_scan++;
+
+	return 0;
+}
+
+/*
+ * Sorts the new index, drops names found in more than one directory,
+ * and puts it in use.
+ */
+static void
+scan_done()
+{
+	size_t i, n;
+
+	qsort(scan, n_scan, sizeof(*scan), compare_names);
+	for (i = n = 0; i < n_scan; i++) {
+		if (n > 0 && strcmp(scan[n - 1], scan[i]) == 0)
+			free(scan[i]);
+		else
+			scan[n++] = scan[i];
+	}
+
+	free_names(names, n_names);
+	names = scan;
+	n_names = n;
+	scan = NULL;
+	n_scan = scan_max = 0;
+	scanning = 0;
+
+	TRACE("path index: %zu executables", n_names);
+}
+
+static void
+free_names(char **v, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		free(v[i]);
+	free(v);
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Finds at most (k) executables whose name begins with (s) of length
+ * (len), in alphabetical order. Stores them to (name) and returns how
+ * many were found.
+ */
+int
+path_complete(const char *s, size_t len, const char **name, int k)
+{
+	size_t lo, hi, mid;
+	int n;
+
+	lo = 0;
+	hi = n_names;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(names[mid], s, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (n = 0; n < k && lo < n_names; n++, lo++) {
+		if (strncmp(names[lo], s, len) != 0)
+			break;
+		name[n] = names[lo];
+	}
+
+	return n;
+}
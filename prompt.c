@@ -17,55 +17,261 @@
 
 #include "extern.h"
 
+#include <ctype.h>
+
 static int isu8cont(unsigned char);
-static int is_empty(struct prompt *);
-static int is_full(struct prompt *);
+static int isword(unsigned char);
+static size_t columns(const char *, size_t);
+static int insert(struct prompt *, const char *, size_t);
+static int move_left(struct prompt *);
+static int move_right(struct prompt *);
+static void delete_left(struct prompt *);
+static void delete_right(struct prompt *);
+static void word_left(struct prompt *);
+static void word_right(struct prompt *);
+static void kill_left(struct prompt *, size_t);
+static void kill_right(struct prompt *, size_t);
+static void set_line(struct prompt *, const char *, size_t);
+static void history_step(struct prompt *, int);
+static int accept_hint(struct prompt *);
 static int handle_keycode(struct prompt *, Display *, XKeyEvent *);
 
 /*
- * Backspace UTF-8.
+ * Text last killed, for yanking back to any prompt.
  */
-void
-prompt_backspace(struct prompt *p)
+static char killbuf[PROMPT_MAX];
+static size_t kill_len;
+
+static int
+isu8cont(unsigned char c)
 {
-	do {
-		if (is_empty(p))
-			break;
-		*(p->cursor)-- = '\0';
-	} while(isu8cont(*p->cursor));
+	return (c & (0x80 | 0x40)) == 0x80;
 }
 
 static int
-is_empty(struct prompt *p)
+isword(unsigned char c)
 {
-	return (p->cursor == p->text);
+	return isalnum(c) || c >= 0x80;
 }
 
+/*
+ * Counts the characters in UTF-8 (s) of length (n).
+ */
+static size_t
+columns(const char *s, size_t n)
+{
+	size_t i, col;
+
+	for (i = col = 0; i < n; i++)
+		if (!isu8cont(s[i]))
+			col++;
+
+	return col;
+}
+
+/*
+ * Inserts (s) of length (n) at the cursor, if it fits whole.
+ */
 static int
-isu8cont(unsigned char c)
+insert(struct prompt *p, const char *s, size_t n)
 {
-	return (c & (0x80 | 0x40)) == 0x80;
+	/* Room is left for the NUL of prompt_text() */
+	if (n >= p->gap_end - p->gap)
+		return 0;
+
+	memcpy(&p->buf[p->gap], s, n);
+	p->gap += n;
+	return 1;
 }
 
 /*
- * Insert UTF-8.
+ * Moves the cursor over one character, which moves the character to
+ * the other side of the gap.
  */
-void
-prompt_insert(struct prompt *p, char *s)
+static int
+move_left(struct prompt *p)
 {
-	while (*s != '\0') {
-		if (is_full(p))
-			break;
-		*(p->cursor)++ = *s++;
+	if (p->gap == 0)
+		return 0;
+
+	do
+		p->buf[--p->gap_end] = p->buf[--p->gap];
+	while (p->gap > 0 && isu8cont(p->buf[p->gap_end]));
+
+	return 1;
+}
+
+static int
+move_right(struct prompt *p)
+{
+	if (p->gap_end == PROMPT_MAX)
+		return 0;
+
+	do
+		p->buf[p->gap++] = p->buf[p->gap_end++];
+	while (p->gap_end < PROMPT_MAX && isu8cont(p->buf[p->gap_end]));
+
+	return 1;
+}
+
+static void
+delete_left(struct prompt *p)
+{
+	while (p->gap > 0 && isu8cont(p->buf[--p->gap]))
+		;
+}
+
+static void
+delete_right(struct prompt *p)
+{
+	if (p->gap_end == PROMPT_MAX)
+		return;
+
+	do
+		p->gap_end++;
+	while (p->gap_end < PROMPT_MAX && isu8cont(p->buf[p->gap_end]));
+}
+
+static void
+word_left(struct prompt *p)
+{
+	while (p->gap > 0 && !isword(p->buf[p->gap - 1]))
+		move_left(p);
+	while (p->gap > 0 && isword(p->buf[p->gap - 1]))
+		move_left(p);
+}
+
+static void
+word_right(struct prompt *p)
+{
+	while (p->gap_end < PROMPT_MAX && !isword(p->buf[p->gap_end]))
+		move_right(p);
+	while (p->gap_end < PROMPT_MAX && isword(p->buf[p->gap_end]))
+		move_right(p);
+}
+
+/*
+ * Kills the text from (start) to the cursor.
+ */
+static void
+kill_left(struct prompt *p, size_t start)
+{
+	if (start == p->gap)
+		return;
+
+	kill_len = p->gap - start;
+	memcpy(killbuf, &p->buf[start], kill_len);
+	p->gap = start;
+}
+
+/*
+ * Kills the text from the cursor to (end), given as an offset to the
+ * text after the gap.
+ */
+static void
+kill_right(struct prompt *p, size_t end)
+{
+	if (end == p->gap_end)
+		return;
+
+	kill_len = end - p->gap_end;
+	memcpy(killbuf, &p->buf[p->gap_end], kill_len);
+	p->gap_end = end;
+}
+
+/*
+ * Replaces the line with (s) of length (n), cursor at the end. Only
+ * the part that differs needs to be drawn again.
+ */
+static void
+set_line(struct prompt *p, const char *s, size_t n)
+{
+	const char *old;
+	size_t i;
+
+	old = prompt_text(p);
+	for (i = 0; i < n && old[i] == s[i]; i++)
+		;
+	while (i > 0 && i < n && isu8cont(s[i]))
+		i--;
+	if (columns(s, i) < p->redraw)
+		p->redraw = columns(s, i);
+
+	if (n >= PROMPT_MAX) {
+		n = PROMPT_MAX - 1;
+		while (n > 0 && isu8cont(s[n]))
+			n--;
 	}
+	p->gap = 0;
+	p->gap_end = PROMPT_MAX;
+	insert(p, s, n);
+}
+
+/*
+ * Steps (dir) lines back in the history, to the lines that begin with
+ * what was typed before stepping back, or forward, which ends with
+ * the line typed.
+ */
+static void
+history_step(struct prompt *p, int dir)
+{
+	const char *s;
+	size_t len;
+
+	if (dir < 0 && p->history == 0)
+		return;
 
-	*p->cursor = '\0';
+	if (p->history == 0) {
+		p->saved_len = p->gap + PROMPT_MAX - p->gap_end;
+		memcpy(p->saved, prompt_text(p), p->saved_len);
+	}
+
+	if (dir < 0 && p->history == 1) {
+		set_line(p, p->saved, p->saved_len);
+		p->history = 0;
+		p->history_at = NULL;
+		return;
+	}
+
+	len = p->saved_len;
+	s = history_walk(&p->history_at, dir, p->saved, &len);
+	if (s != NULL) {
+		set_line(p, s, len);
+		p->history += dir;
+	}
 }
 
+/*
+ * Accepts the completion shown after the line, or if there is none,
+ * the best ranked one.
+ */
 static int
-is_full(struct prompt *p)
+accept_hint(struct prompt *p)
 {
-	return ((p->cursor - p->text) == sizeof(p->text) - 2);
+	if (p->gap_end == PROMPT_MAX && p->hint_len > 0)
+		return insert(p, p->hint, p->hint_len);
+	if (p->ncandidates > 0) {
+		set_line(p, p->candidate[0], p->candidate_len[0]);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The line being edited, NUL terminated.
+ */
+const char *
+prompt_text(struct prompt *p)
+{
+	size_t after;
+
+	after = PROMPT_MAX - p->gap_end;
+	memcpy(p->text, p->buf, p->gap);
+	memcpy(&p->text[p->gap], &p->buf[p->gap_end], after);
+	p->text[p->gap + after] = '\0';
+
+	return p->text;
 }
 
 /*
@@ -82,9 +288,11 @@ prompt_init(struct prompt *p, struct pane *pane, struct layout *layout)
 
 	TRACE("prompt init");
 
-	p->cursor = &p->text[0];
+	p->gap = 0;
+	p->gap_end = PROMPT_MAX;
 	p->text[0] = '\0';
 	p->pane = pane;
+	p->layout = layout;
 
 	dpy = layout->display;
 	assert(pane->frame != 0);
@@ -95,96 +303,232 @@ prompt_init(struct prompt *p, struct pane *pane, struct layout *layout)
 }
 
 /*
- * Read text from the prompt.
+ * Start editing in the prompt. Keys typed while its pane has focus are
+ * given to prompt_key() by the main event loop; (step) is called after
+ * each edit, and (finish) once with the text when Return is pressed or
+ * with NULL when editing is cancelled.
  */
-int
-prompt_read(struct prompt *p, PromptCallback callback, PromptCallback step, void *udata)
+void
+prompt_begin(struct prompt *p, PromptCallback finish, PromptCallback step,
+    void *udata)
 {
-	Display *dpy;
-	int ret = 1;
-
 	assert(p != NULL);
 	assert(p->pane != NULL);
 
-	if (p->pane->column == NULL)
-		return 0;
+	p->finish = finish;
+	p->step = step;
+	p->udata = udata;
+	p->ncandidates = 0;
+	p->hint_len = 0;
+	p->history = 0;
+	p->history_at = NULL;
+	p->pane->flags |= PF_EDIT;
+}
 
-	dpy = p->pane->column->layout->display;
-
-	TRACE("Grabkeyb");
-	XGrabKeyboard(dpy, p->pane->frame, True, GrabModeAsync, GrabModeAsync,
-	    CurrentTime);
-	XSetICFocus(p->ic);
-	XSync(dpy, False);
-
-	while (ret == 1) {
-		XEvent e;
-
-		XNextEvent(dpy, &e);
-		switch (e.type) {
-		case KeyPress:
-			ret = handle_keycode(p, dpy, &e.xkey);
-			if (ret == -1 || ret == 0) {
-				p->pane->flags &= ~PF_EDIT;
-				if (ret == 0) {
-					ret = 1;
-					goto exitloop;
-				} else
-					ret = 0;
-			}
-			step(p->text, udata);
-			draw_frame(p->pane, p->pane->column->layout);
-			break;
-		case KeyRelease:
-			break;
-		case ButtonPress:
-		case ButtonRelease:
-			ret = 0;
-			break;
-		default:
-			handle_event(dpy, &e, p->pane->column->layout->context,
-		                     p->pane->column->layout);
-			break;
-		}
+/*
+ * Directs the keyboard to the prompt (on) of the focused pane, or back
+ * to normal. Bound keys still reach us through the grab and are acted
+ * upon as usual, see handle_event().
+ */
+void
+prompt_focus(struct prompt *p, int on)
+{
+	Display *dpy;
+
+	dpy = p->layout->display;
+
+	if (on) {
+		TRACE("Grabkeyb");
+		XGrabKeyboard(dpy, p->pane->frame, False, GrabModeAsync,
+		    GrabModeAsync, CurrentTime);
+		XSetICFocus(p->ic);
+	} else {
+		XUnsetICFocus(p->ic);
+		XUngrabKeyboard(dpy, CurrentTime);
 	}
-exitloop:
+}
 
-	draw_frame(p->pane, p->pane->column->layout);
-	XUnsetICFocus(p->ic);
-	XUngrabKeyboard(dpy, CurrentTime);
-	XSync(dpy, False);
+/*
+ * Handles a key pressed in the prompt. Keys with a binding do not come
+ * here, see handle_event().
+ */
+void
+prompt_key(struct prompt *p, XKeyEvent *e)
+{
+	struct pane *pane;
+	size_t col;
+	int ret;
 
-	return ret;
+	pane = p->pane;
+	p->redraw = columns(p->buf, p->gap);
+	ret = handle_keycode(p, p->layout->display, e);
+	if (ret == 1) {
+		if ((col = columns(p->buf, p->gap)) < p->redraw)
+			p->redraw = col;
+		p->step(prompt_text(p), p->udata);
+		draw_prompt(pane, p->layout, p->redraw);
+		return;
+	}
+
+	/*
+	 * The pane may be gone once (finish) returns, so it is the last
+	 * thing done.
+	 */
+	pane->flags &= ~PF_EDIT;
+	if (pane->flags & PF_FOCUSED)
+		prompt_focus(p, 0);
+	draw_frame(pane, p->layout);
+	p->finish((ret == 0) ? prompt_text(p) : NULL, p->udata);
 }
 
+/*
+ * Edits the line as told by a key (e). Returns 0 when the line is
+ * done, -1 when editing is cancelled and 1 otherwise.
+ */
 static int
 handle_keycode(struct prompt *p, Display *dpy, XKeyEvent *e)
 {
 	KeySym sym;
-	int n;
-	char ch[4 + 1];
+	size_t i;
+	Status status;
+	int n, step;
+	char ch[32];
 
 	sym = XkbKeycodeToKeysym(dpy, e->keycode, 0,
 	    (e->state & ShiftMask) ? 1 : 0);
 
-	switch (sym) {
-	case XK_Escape:
-		TRACE("Got escape, return -1");
-		return -1;
-	case XK_Return:
-		TRACE("Got return, return 0");
-		return 0;
-	case XK_BackSpace:
-	case XK_Delete:
-		prompt_backspace(p);
-		break;
-	default:
-		n = Xutf8LookupString(p->ic, e, ch, sizeof(ch)-1, &sym, NULL);
-		if (n > 0) {
-			ch[n] = '\0';
-			prompt_insert(p, ch);
+	step = 0;
+	if (e->state & ControlMask) {
+		switch (sym) {
+		case XK_g:
+			return -1;
+		case XK_a:
+			while (move_left(p))
+				;
+			break;
+		case XK_e:
+			while (move_right(p))
+				;
+			break;
+		case XK_b:
+			move_left(p);
+			break;
+		case XK_f:
+			if (!move_right(p))
+				accept_hint(p);
+			break;
+		case XK_h:
+			delete_left(p);
+			break;
+		case XK_d:
+			delete_right(p);
+			break;
+		case XK_w:
+			for (i = p->gap; i > 0 &&
+			    isspace((unsigned char) p->buf[i - 1]); i--)
+				;
+			for (; i > 0 &&
+			    !isspace((unsigned char) p->buf[i - 1]); i--)
+				;
+			kill_left(p, i);
+			break;
+		case XK_u:
+			kill_left(p, 0);
+			break;
+		case XK_k:
+			kill_right(p, PROMPT_MAX);
+			break;
+		case XK_y:
+			insert(p, killbuf, kill_len);
+			break;
+		case XK_p:
+			history_step(p, 1);
+			step = 1;
+			break;
+		case XK_n:
+			history_step(p, -1);
+			step = 1;
+			break;
+		}
+	} else if (e->state & Mod1Mask) {
+		switch (sym) {
+		case XK_b:
+			word_left(p);
+			break;
+		case XK_f:
+			word_right(p);
+			break;
+		case XK_BackSpace:
+			for (i = p->gap; i > 0 && !isword(p->buf[i - 1]); i--)
+				;
+			for (; i > 0 && isword(p->buf[i - 1]); i--)
+				;
+			kill_left(p, i);
+			break;
+		case XK_d:
+			for (i = p->gap_end; i < PROMPT_MAX &&
+			    !isword(p->buf[i]); i++)
+				;
+			for (; i < PROMPT_MAX && isword(p->buf[i]); i++)
+				;
+			kill_right(p, i);
+			break;
+		}
+	} else {
+		switch (sym) {
+		case XK_Escape:
+			TRACE("Got escape, return -1");
+			return -1;
+		case XK_Return:
+		case XK_KP_Enter:
+			TRACE("Got return, return 0");
+			return 0;
+		case XK_BackSpace:
+			delete_left(p);
+			break;
+		case XK_Delete:
+			delete_right(p);
+			break;
+		case XK_Left:
+			move_left(p);
+			break;
+		case XK_Right:
+			if (!move_right(p))
+				accept_hint(p);
+			break;
+		case XK_Home:
+			while (move_left(p))
+				;
+			break;
+		case XK_End:
+			while (move_right(p))
+				;
+			break;
+		case XK_Up:
+			history_step(p, 1);
+			step = 1;
+			break;
+		case XK_Down:
+			history_step(p, -1);
+			step = 1;
+			break;
+		case XK_Tab:
+			accept_hint(p);
+			break;
+		default:
+			n = Xutf8LookupString(p->ic, e, ch, sizeof(ch), &sym,
+			    &status);
+			if ((status == XLookupChars || status == XLookupBoth) &&
+			    !iscntrl((unsigned char) ch[0]))
+				insert(p, ch, n);
+			break;
 		}
-		break;
+	}
+
+	/* Any edit makes the line the one typed */
+	if (!step) {
+		p->history = 0;
+		p->history_at = NULL;
 	}
 
 	return 1;
@@ -38,6 +38,31 @@ force_one_maximized(struct column *ws)
 	resize_relayout(ws->layout->focus->column);
 }
 
+/*
+ * Smallest and largest height, titlebar included, that a pane (p) may
+ * be given according to the size hints of its client. Zero maximum
+ * means unlimited.
+ */
+static int
+pane_min_height(struct pane *p, struct layout *l)
+{
+	if (p->flags & PF_WITHOUT_WINDOW)
+		return l->titlebar_height_px;
+
+	return l->titlebar_height_px + p->min_height;
+}
+
+static int
+pane_max_height(struct pane *p, struct layout *l)
+{
+	if (p->flags & PF_WITHOUT_WINDOW)
+		return l->titlebar_height_px;
+	if (p->max_height <= 0)
+		return 0;
+
+	return l->titlebar_height_px + p->max_height;
+}
+
 /*
  * - Adding a pane results in SHRINKING other panes.
  *   - Unless all other panes are MINIMIZED.
@@ -46,40 +71,76 @@ force_one_maximized(struct column *ws)
  *   - Unless it is MINIMIZED, it gets MINIMIZED SIZE.
  *   - Unless MORE is available, it gets MORE.
  *
- * - In the SHRINKING, EQUAL is substracted from panes larger than 'equal'.
+ * - In the SHRINKING, panes larger than 'equal' give up space in
+ *   proportion to how much they are above 'equal'.
  *   - Panes that are less than 'equal' require no action.
- *   - EQUAL is the equally divided requirement for more space.
- *   - No pane is made smaller than 'equal'.
+ *   - No pane is made smaller than 'equal' or its minimum size.
+ *
+ * Everything is done in a fixed number of passes over the column so
+ * that the cost stays linear in the number of panes.
  */
-static int calculate_new_equal(struct column *, struct pane *);
-static int sum_heights(struct column *, struct pane *);
-static void shrink_other_panes(struct column *, struct pane *, int, int);
+static void scan_column(struct column *, struct pane *, int *, int *, int *);
+static int shrink_other_panes(struct column *, struct pane *, int, int);
+static int grow_other_panes(struct column *, struct pane *, int);
 
 void
 resize_add(struct column *ws, struct pane *pane)
 {
+	struct layout *l = ws->layout;
+	int n, minimized_px, others;
 	int equal;
-	int total;
 	int required;
+	int need;
 	int toolittle;
+	int max;
 
-	equal = calculate_new_equal(ws, pane);
+	scan_column(ws, pane, &n, &minimized_px, &others);
 
 	if (pane->flags & PF_WITHOUT_WINDOW)
-		required = ws->layout->titlebar_height_px;
+		minimized_px += l->titlebar_height_px + l->vspacing;
+	else
+		n++;
+
+	TRACE("equal n=%d minimized_px=%d", n, minimized_px);
+	if (n == 0)
+		equal = ws->max_height - minimized_px;
+	else
+		equal = (ws->max_height - minimized_px -
+		    (n * l->vspacing)) / n;
+
+	if (pane->flags & PF_WITHOUT_WINDOW)
+		required = l->titlebar_height_px;
 	else {
 		if (pane->adjusted_height > 0 &&
 		    pane->adjusted_height < equal)
 			required = pane->adjusted_height;
 		else
 			required = equal;
+		if (required < pane_min_height(pane, l))
+			required = pane_min_height(pane, l);
+		max = pane_max_height(pane, l);
+		if (max > 0 && required > max)
+			required = max;
 	}
 
 	TRACE("required %d equal %d", required, equal);
 
-	shrink_other_panes(ws, pane, required, equal);
+	/*
+	 * Only take from the others what they are not already leaving
+	 * unused, and don't give more than could be taken.
+	 */
+	need = required - (ws->max_height - others);
+	if (need > 0)
+		others -= shrink_other_panes(ws, pane, need, equal);
 
 	pane->height = required;
+	if (ws->max_height - others < required) {
+		TRACE("could free only %d of %d", ws->max_height - others,
+		    required);
+		pane->height = ws->max_height - others;
+		if (pane->height < l->titlebar_height_px)
+			pane->height = l->titlebar_height_px;
+	}
 
 	/*
 	 * Nothing to do anymore if we were minimized.
@@ -90,124 +151,153 @@ resize_add(struct column *ws, struct pane *pane)
 	/*
 	 * Did we have more space after all? Make our pane larger.
 	 */
-	total = sum_heights(ws, pane) + required;
-	toolittle = ws->max_height - total;
+	toolittle = ws->max_height - (others + pane->height);
 
 	TRACE("toolittle %d", toolittle);
-	if (toolittle > 0)
+	if (toolittle > 0) {
+		max = pane_max_height(pane, l);
+		if (max > 0 && pane->height + toolittle > max)
+			toolittle = max - pane->height;
 		pane->height += toolittle;
+	}
 }
 
-static int
-calculate_new_equal(struct column *ws, struct pane *ignore)
+/*
+ * Counts in one pass the panes with a window (n), the space taken by
+ * panes without one (minimized_px) and the sum of all pane heights
+ * (total) in a column (ws), leaving out pane (ignore).
+ */
+static void
+scan_column(struct column *ws, struct pane *ignore, int *n,
+    int *minimized_px, int *total)
 {
 	struct pane *p;
-	int n = 0;
-	int minimized_px = 0;
-	int total_vspace;
-
-	if (ignore->flags & PF_WITHOUT_WINDOW) {
-		minimized_px += ws->layout->titlebar_height_px;
-		minimized_px += ws->layout->vspacing;
-	} else
-		n++;
+
+	*n = *minimized_px = *total = 0;
 
 	for (p = ws->first; p != NULL; p = p->next) {
 		if (p == ignore)
 			continue;
+		*total += p->height;
 		if (p->flags & PF_WITHOUT_WINDOW) {
-			minimized_px += ws->layout->titlebar_height_px;
-			minimized_px += ws->layout->vspacing;
+			*minimized_px += ws->layout->titlebar_height_px;
+			*minimized_px += ws->layout->vspacing;
 		} else
-			n++;
+			(*n)++;
 	}
-
-	TRACE("equal n=%d minimized_px=%d", n, minimized_px);
-	if (n == 0)
-		return (ws->max_height - minimized_px);
-	else
-		return (ws->max_height - minimized_px - (n * ws->layout->vspacing)) / n;
 }
 
+/*
+ * Takes up to 'required' pixels from panes that are larger than
+ * 'equal', in proportion to their excess. A running total is used for
+ * rounding so that the slices always sum up exactly. Returns the number
+ * of pixels taken, which is less than 'required' only if the column did
+ * not have enough excess in total.
+ */
 static int
-sum_heights(struct column *ws, struct pane *ignore)
+shrink_other_panes(struct column *ws, struct pane *ignore, int required,
+    int equal)
 {
 	struct pane *p;
-	int total = 0;
+	long excess, seen;
+	int floor, taken, cut;
+
+	if (required <= 0)
+		return 0;
 
+	excess = 0;
 	for (p = ws->first; p != NULL; p = p->next) {
-		if (p == ignore)
+		if (p == ignore || p->flags & PF_WITHOUT_WINDOW)
 			continue;
-		total += p->height;
+		floor = pane_min_height(p, ws->layout);
+		if (floor < equal)
+			floor = equal;
+		if (p->height > floor)
+			excess += p->height - floor;
 	}
 
-	return total;
+	TRACE("shrink excess=%ld required=%d", excess, required);
+
+	/*
+	 * All existing panes minimized or smaller than 'equal' ?
+	 */
+	if (excess == 0)
+		return 0;	/* Nothing to do. */
+
+	if (required > excess)
+		required = excess;
+
+	seen = taken = 0;
+	for (p = ws->first; p != NULL; p = p->next) {
+		if (p == ignore || p->flags & PF_WITHOUT_WINDOW)
+			continue;
+		floor = pane_min_height(p, ws->layout);
+		if (floor < equal)
+			floor = equal;
+		if (p->height <= floor)
+			continue;
+
+		seen += p->height - floor;
+		cut = (int) ((seen * required) / excess) - taken;
+		p->height -= cut;
+		taken += cut;
+	}
+
+	TRACE("shrink taken %d", taken);
+	assert(taken == required);
+	return taken;
 }
 
-static void
-shrink_other_panes(struct column *ws, struct pane *ignore, int required, int equal)
+/*
+ * Hands out 'surplus' pixels evenly to the panes of a column (ws)
+ * that have a window, except to (ignore), without making any pane
+ * larger than its maximum size. What a capped pane could not take is
+ * handed out on a second pass to the panes that can still grow.
+ * Returns the number of pixels that nobody could take.
+ */
+static int
+grow_other_panes(struct column *ws, struct pane *ignore, int surplus)
 {
 	struct pane *p;
-	int n = 0;
-	int slice;
-	int tries = 0;
+	int n, pass, slice, max;
 
-	if (required <= 0)
-		return;
-
-	/*
-	 * Shrink panes that are larger than 'equal', shrink down to 'equal'.
-	 */
-	while (required > 0 && tries-- < 100) {
+	for (pass = 0; pass < 2 && surplus > 0; pass++) {
+		n = 0;
 		for (p = ws->first; p != NULL; p = p->next) {
-			if (p == ignore)
-				continue;
-			if (p->flags & PF_WITHOUT_WINDOW)
+			if (p == ignore || p->flags & PF_WITHOUT_WINDOW)
 				continue;
-			if (p->height > equal)
+			max = pane_max_height(p, ws->layout);
+			if (max == 0 || p->height < max)
 				n++;
 		}
 
+		TRACE("surplus %d n %d", surplus, n);
+
 		/*
-		 * All existing panes minimized or smaller than 'equal' ?
+		 * All are minimized or at their maximum size?
 		 */
 		if (n == 0)
-			return;	/* Nothing to do. */
+			break;	/* Nothing to do. */
 
-		for (p = ws->first; p != NULL; p = p->next) {
-			if (p == ignore)
+		for (p = ws->first; p != NULL && n > 0; p = p->next) {
+			if (p == ignore || p->flags & PF_WITHOUT_WINDOW)
 				continue;
-			if (p->flags & PF_WITHOUT_WINDOW)
+			max = pane_max_height(p, ws->layout);
+			if (max > 0 && p->height >= max)
 				continue;
 
-			slice = required;
-			assert(n > 0);
-			if (n > 0)
-				slice /= n;
-			TRACE("shrink candidate n=%d, slice=%d required=%d", n, slice, required);
-
-			if (p->height > equal) {
-				TRACE("p->height - equal == %d", p->height - equal);
-				TRACE("p->height == %d", p->height);
-				if (p->height - equal >= slice) {
-					required -= slice;
-					p->height -= slice;
-					TRACE("sub slice (slice=%d), required now %d, height now %d", slice, required, p->height);
-				} else {
-					required -= (p->height - equal);
-					p->height = equal;
-					TRACE("equalize, height is now %d required now %d", p->height, required);
-				}
-				if (--n == 0) {
-					TRACE("required left %d", required);
-					break;
-				}
-			}
+			slice = surplus / n--;
+			if (max > 0 && p->height + slice > max)
+				slice = max - p->height;
+
+			TRACE("surplus slice %d", slice);
+
+			p->height += slice;
+			surplus -= slice;
 		}
 	}
 
-	TRACE("required left final %d", required);
-	assert(required == 0);
+	return surplus;
 }
 
 /*
@@ -219,57 +309,19 @@ shrink_other_panes(struct column *ws, struct pane *ignore, int required, int equ
 void
 resize_remove(struct column *ws, struct pane *ignore)
 {
-	struct pane *p;
-	int n = 0;
+	int n, minimized_px, total;
 	int surplus;
-	int slice;
 
-	surplus = ws->max_height - sum_heights(ws, ignore);
+	scan_column(ws, ignore, &n, &minimized_px, &total);
+
+	surplus = ws->max_height - total;
 	TRACE("surplus %d", surplus);
-	assert(surplus > 0);
 	if (surplus <= 0)
 		return;
 
-	for (p = ws->first; p != NULL; p = p->next) {
-		if (p == ignore)
-			continue;
-		if (p->flags & PF_WITHOUT_WINDOW)
-			continue;
-		n++;
-	}
-
-	TRACE("surplus n %d", n);
-
-	/*
-	 * All are minimized?
-	 */
-	if (n == 0)
-		return;	/* Nothing to do. */
-
-	for (p = ws->first; p != NULL; p = p->next) {
-		if (p == ignore)
-			continue;
-		if (p->flags & PF_WITHOUT_WINDOW)
-			continue;
-
-		slice = surplus;
-		assert(slice >= 0);
-		if (slice <= 0)
-			break;
-
-		assert(n > 0);
-		if (n > 0)
-			slice /= n;
-
-		TRACE("surplus slice %d", slice);
-
-		p->height += slice;
-		surplus -= slice;
-		if (--n == 0) {
-			assert(surplus == 0);
-			break;
-		}
-	}
+	surplus = grow_other_panes(ws, ignore, surplus);
+	if (surplus > 0)
+		TRACE("surplus left unused %d", surplus);
 }
 
 /*
@@ -343,14 +395,98 @@ resize_adjust(struct column *ws, struct pane *pane, int adj)
 	}
 }
 
+/*
+ * Largest client height not above 'h' that the client of a pane (p)
+ * accepts according to its size hints, i.e. base_height + k * height_inc
+ * and between min_height and max_height. Clients given such a height
+ * have no reason to come back with a ConfigureRequest of their own.
+ * The client never gets more than the 'h' pixels there are, even if
+ * that is below its min_height.
+ */
+static int
+snap_client_height(struct pane *p, int h)
+{
+	int avail = h;
+
+	if (p->height_inc > 1 && h > p->base_height)
+		h -= (h - p->base_height) % p->height_inc;
+	if (p->max_height > 0 && h > p->max_height)
+		h = p->max_height;
+	if (h < p->min_height)
+		h = p->min_height;
+	if (h > avail)
+		h = avail;
+
+	return h;
+}
+
+/*
+ * Snaps pane heights in a column (ws) to the resize increments of their
+ * clients, then hands the pixels cut off back one increment at a time
+ * to the panes that can take a full increment, so that the column stays
+ * filled. A pane without increments takes all that is left. Whatever is
+ * still left over is smaller than any increment and is given to the
+ * frame of the last pane, below its client.
+ */
+static void
+snap_heights(struct column *ws)
+{
+	struct pane *p, *last = NULL;
+	int title, h, step, leftover = 0;
+
+	title = ws->layout->titlebar_height_px;
+
+	for (p = ws->first; p != NULL; p = p->next) {
+		if (p->flags & PF_WITHOUT_WINDOW || p->height <= title)
+			continue;
+		h = title + snap_client_height(p, p->height - title);
+		leftover += p->height - h;
+		p->height = h;
+		last = p;
+	}
+
+	for (p = ws->first; p != NULL && leftover > 0; p = p->next) {
+		if (p->flags & PF_WITHOUT_WINDOW || p->height <= title)
+			continue;
+		step = (p->height_inc > 1) ? p->height_inc : leftover;
+		if (step > leftover)
+			continue;
+		if (p->max_height > 0 && p->height - title + step >
+		    p->max_height)
+			continue;
+		p->height += step;
+		leftover -= step;
+	}
+
+	if (leftover > 0 && last != NULL)
+		last->height += leftover;
+}
+
 void
 resize_relayout(struct column *ws)
 {
 	struct pane *p;
 	int y = 0;
+	int configured = 0;
+	bool frame_changed;
 
 	TRACE("resize relayout ws->n %d", ws->n);
 
+	snap_heights(ws);
+
+	/*
+	 * Panes are only placed, and configured when the layout is
+	 * committed.
+	 */
+	if (ws->layout->defer) {
+		for (p = ws->first; p != NULL; p = p->next) {
+			p->y = y;
+			y += p->height + ws->layout->vspacing;
+		}
+		ws->dirty = true;
+		return;
+	}
+
 	/*
 	 * If we get error here it means we're in middle of destroying
 	 * multiple windows, or similar situation, which means we'll get
@@ -359,6 +495,11 @@ resize_relayout(struct column *ws)
 	has_resize_err = 0;
 	XSetErrorHandler(wm_resize_error);
 
+	/*
+	 * Only panes whose geometry differs from what was last sent to
+	 * the server are configured, so that e.g. a change in one pane
+	 * does not make every other client in the column redraw.
+	 */
 	for (p = ws->first; p != NULL; p = p->next) {
 		XWindowChanges changes;
 
@@ -377,22 +518,40 @@ resize_relayout(struct column *ws)
 			changes.height = ws->max_height;
 		}
 
-		TRACE("configuring window x=%d y=%d w=%d h=%d", changes.x,
-		    changes.y, changes.width, changes.height);
-
-		XConfigureWindow(ws->layout->display, p->frame,
-		    CWX | CWY | CWWidth | CWHeight | CWStackMode, &changes);
+		frame_changed = (p->flags & PF_DIRTY ||
+		    changes.x != p->conf_x || changes.y != p->conf_y ||
+		    changes.width != p->conf_width ||
+		    changes.height != p->conf_height);
+
+		if (frame_changed) {
+			TRACE("configuring window x=%d y=%d w=%d h=%d",
+			    changes.x, changes.y, changes.width,
+			    changes.height);
+
+			XConfigureWindow(ws->layout->display, p->frame,
+			    CWX | CWY | CWWidth | CWHeight | CWStackMode,
+			    &changes);
+			p->conf_x = changes.x;
+			p->conf_y = changes.y;
+			p->conf_width = changes.width;
+			p->conf_height = changes.height;
+			p->flags &= ~PF_DIRTY;
+			configured++;
+		}
 
 		TRACE("relayout y=%d height=%d", p->y, p->height);
 
 		changes.x = 0;
 		changes.y = ws->layout->titlebar_height_px;
-		changes.height = changes.height - ws->layout->titlebar_height_px;
+		changes.height = snap_client_height(p,
+		    changes.height - ws->layout->titlebar_height_px);
 		changes.stack_mode = Above;
 
 		y += p->height + ws->layout->vspacing;
 
-		if (p->flags & PF_WITHOUT_WINDOW || changes.height == 0)
+		if (p->flags & PF_WITHOUT_WINDOW || changes.height <= 0)
+			continue;
+		if (!frame_changed && changes.height == p->conf_client_height)
 			continue;
 
 		TRACE("configuring subwindow x=%d y=%d w=%d h=%d", changes.x,
@@ -400,6 +559,8 @@ resize_relayout(struct column *ws)
 
 		XConfigureWindow(ws->layout->display, p->window,
 		    CWX | CWY | CWWidth | CWHeight | CWStackMode, &changes);
+		p->conf_client_height = changes.height;
+		configured++;
 	}
 
 	for (p = ws->first; p != NULL; p = p->next) {
@@ -413,6 +574,112 @@ resize_relayout(struct column *ws)
 		XRaiseWindow(ws->layout->display, p->frame);
 	}
 
-	XSync(ws->layout->display, False);
+	TRACE("relayout configured %d windows", configured);
+	if (configured > 0) {
+		control_event("relayout %d %d", column_index(ws), configured);
+		ewmh_layout();
+	}
+
+	if (configured > 0)
+		XSync(ws->layout->display, False);
 	XSetErrorHandler(None);
 }
+
+/*
+ * Ends deferring the layout (l), and relayouts each column changed
+ * meanwhile once.
+ */
+void
+resize_commit(struct layout *l)
+{
+	struct column *c;
+
+	l->defer = false;
+	for (c = l->head; c != NULL; c = c->next)
+		if (c->dirty) {
+			c->dirty = false;
+			resize_relayout(c);
+		}
+}
+
+/*
+ * Configures the frame and client of a pane (p) to 'y' and 'height'
+ * without touching the rest of its column, e.g. for showing where a
+ * pointer resize would put the pane. The next resize_relayout() of the
+ * column puts the pane back where the layout wants it.
+ */
+void
+resize_preview(struct pane *p, int y, int height)
+{
+	struct column *ws = p->column;
+	XWindowChanges changes;
+
+	if (ws == NULL)
+		return;
+
+	changes.x = ws->x;
+	changes.y = y;
+	changes.width = ws->width;
+	changes.height = height;
+
+	/* A frame moved elsewhere, e.g. to another column, is dirty */
+	if (p->flags & PF_DIRTY ||
+	    changes.x != p->conf_x || changes.y != p->conf_y ||
+	    changes.width != p->conf_width || changes.height != p->conf_height) {
+		XConfigureWindow(ws->layout->display, p->frame,
+		    CWX | CWY | CWWidth | CWHeight, &changes);
+		p->conf_x = changes.x;
+		p->conf_y = changes.y;
+		p->conf_width = changes.width;
+		p->conf_height = changes.height;
+		p->flags &= ~PF_DIRTY;
+	}
+
+	if (p->flags & PF_WITHOUT_WINDOW)
+		return;
+
+	changes.height = snap_client_height(p,
+	    height - ws->layout->titlebar_height_px);
+	if (changes.height <= 0 || changes.height == p->conf_client_height)
+		return;
+
+	XResizeWindow(ws->layout->display, p->window, changes.width,
+	    changes.height);
+	p->conf_client_height = changes.height;
+}
+
+/*
+ * Handles a request from the client of a pane (p) in a column (ws) to
+ * have its height changed to 'height' pixels. The request is accepted
+ * only if it is something the client's own size hints allow and there
+ * are other panes in the column to give or take the difference.
+ *
+ * Returns 1 if the layout was changed and the column should be laid out
+ * again, 0 if the current geometry stands.
+ */
+int
+resize_request(struct column *ws, struct pane *p, int height)
+{
+	int title, current, old;
+
+	if (p->flags & (PF_WITHOUT_WINDOW | PF_FULLSCREEN))
+		return 0;
+
+	title = ws->layout->titlebar_height_px;
+	current = snap_client_height(p, p->height - title);
+
+	if (height == current)
+		return 0;
+	if (height < p->min_height || snap_client_height(p, height) != height)
+		return 0;
+	if (p->next == NULL)
+		return 0;
+
+	old = p->height;
+	resize_adjust(ws, p, height - current);
+
+	TRACE("client request %d -> %d %s", current, height,
+	    (p->height != old) ? "accepted" : "denied");
+
+	return (p->height != old);
+}
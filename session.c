@@ -0,0 +1,200 @@
+/*
+ * cocowm - Column Commander Window Manager for X11 Window System
+ * Copyright (c) 2023, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Keeps the layout over a restart of the window manager. Before exec
+ * the panes are written to a property of the root window, in column
+ * order from top to bottom, and read back once the windows have been
+ * captured again. The property goes with the X server, so there is
+ * no file to go stale.
+ */
+
+#include "extern.h"
+
+#include <err.h>
+#include <X11/Xatom.h>
+
+#define SESSION_ATOM "_COCOWM_SESSION"
+
+#ifndef SESSION_VERSION
+#define SESSION_VERSION 1
+#endif
+
+/*
+ * Header: version, number of columns and height of the screen. The
+ * layout is not restored to a different screen.
+ */
+#define SESSION_HEADER 3
+
+/*
+ * For each pane: window, column, height, adjusted height, y_adj,
+ * flags and return priority.
+ */
+#define SESSION_FIELDS 7
+
+#define SESSION_FLAGS (PF_FOCUSED | PF_KEEP_OPEN | PF_MINIMIZED | \
+	PF_HIDDEN | PF_HIDE_OTHERS_LEADER | PF_FULLSCREEN)
+
+static int count_columns(struct layout *);
+
+static int
+count_columns(struct layout *l)
+{
+	struct column *c;
+	int n;
+
+	for (n = 0, c = l->head; c != NULL; c = c->next)
+		n++;
+
+	return n;
+}
+
+/*
+ * Writes the layout (l) to the root window. Empty panes are left out,
+ * as their frames go with us.
+ */
+void
+session_save(struct layout *l)
+{
+	Display *d = l->display;
+	struct column *c;
+	struct pane *p;
+	unsigned long *v, *r;
+	size_t n;
+	int i;
+
+	n = SESSION_HEADER;
+	for (c = l->head; c != NULL; c = c->next)
+		n += c->n * SESSION_FIELDS;
+	if ((v = calloc(n, sizeof(*v))) == NULL) {
+		warn("session");
+		return;
+	}
+
+	v[0] = SESSION_VERSION;
+	v[1] = count_columns(l);
+	v[2] = DisplayHeight(d, DefaultScreen(d));
+	r = &v[SESSION_HEADER];
+	for (i = 0, c = l->head; c != NULL; i++, c = c->next)
+		for (p = c->first; p != NULL; p = p->next) {
+			if (p->flags & PF_EMPTY)
+				continue;
+			*r++ = p->window;
+			*r++ = i;
+			*r++ = p->height;
+			*r++ = p->adjusted_height;
+			*r++ = p->y_adj;
+			*r++ = p->flags & SESSION_FLAGS;
+			*r++ = p->return_priority;
+		}
+
+	n = r - v;
+	XChangeProperty(d, DefaultRootWindow(d),
+	    XInternAtom(d, SESSION_ATOM, False), XA_CARDINAL, 32,
+	    PropModeReplace, (unsigned char *) v, n);
+	XSync(d, False);
+	free(v);
+
+	TRACE("session: saved %zu panes", (n - SESSION_HEADER) /
+	    SESSION_FIELDS);
+}
+
+/*
+ * Puts the panes captured at startup back where they were in the
+ * layout (l) saved before restart, with one relayout per column. The
+ * relayouts as their windows are reparented and mapped are deferred to
+ * the end of the batch of events, see flush_actions().
+ * Panes not in the saved layout are placed as usual when mapped, see
+ * observemap().
+ */
+void
+session_restore(struct layout *l)
+{
+	Display *d = l->display;
+	Atom type;
+	int format;
+	unsigned long n, after, i;
+	unsigned char *data;
+	unsigned long *v;
+	unsigned int priority;
+	struct column *c;
+	struct pane *p, *focus;
+	long col;
+
+	if (XGetWindowProperty(d, DefaultRootWindow(d),
+	    XInternAtom(d, SESSION_ATOM, False), 0, ~0L, True, XA_CARDINAL,
+	    &type, &format, &n, &after, &data) != Success)
+		return;
+	if (data == NULL)
+		return;
+	v = (unsigned long *) data;
+	if (type != XA_CARDINAL || format != 32 || n < SESSION_HEADER ||
+	    v[0] != SESSION_VERSION || v[1] != count_columns(l) ||
+	    v[2] != DisplayHeight(d, DefaultScreen(d))) {
+		TRACE("session: not restoring");
+		XFree(data);
+		return;
+	}
+
+	focus = NULL;
+	priority = 0;
+	l->defer = true;
+	c = l->head;
+	col = 0;
+	for (i = SESSION_HEADER; i + SESSION_FIELDS <= n;
+	    i += SESSION_FIELDS) {
+		if ((p = find_pane_by_window(v[i], l)) == NULL ||
+		    p->window != v[i] || p->column != NULL)
+			continue;
+		while (col < (long) v[i + 1] && c->next != NULL) {
+			c = c->next;
+			col++;
+		}
+
+		p->height = (int) v[i + 2];
+		p->adjusted_height = (int) v[i + 3];
+		p->y_adj = (int) v[i + 4];
+		p->flags = (p->flags & ~SESSION_FLAGS) |
+		    (v[i + 5] & SESSION_FLAGS & ~PF_FOCUSED);
+		p->return_priority = v[i + 6];
+		if (p->return_priority >= priority)
+			priority = p->return_priority + 1;
+		if (v[i + 5] & PF_FOCUSED)
+			focus = p;
+
+		append_pane(p, c);
+
+		/*
+		 * Unmapped before it is reparented, so it stays so. Not
+		 * through minimize(), which would resize the column while
+		 * only part of it is back, and lose the saved heights.
+		 */
+		if (p->flags & PF_MINIMIZED) {
+			transition_pane_state(p, IconicState, d);
+			XUnmapWindow(d, p->window);
+		}
+	}
+	XFree(data);
+
+	resize_commit(l);
+
+	l->return_priority = priority;
+	if (focus != NULL)
+		focus_pane(focus, l);
+
+	TRACE("session: restored");
+}
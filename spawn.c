@@ -0,0 +1,453 @@
+/*
+ * cocowm - Column Commander Window Manager for X11 Window System
+ * Copyright (c) 2023, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Starts programs with posix_spawn(), which does not copy the window
+ * manager the way fork() does, and never waits for them. Commands are
+ * run directly unless they need the shell. The programs started are
+ * kept track of until they exit, see spawn_reap().
+ */
+
+#include "extern.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __OpenBSD__
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+extern char **environ;
+
+/*
+ * A program we started, and the pane held for its window, if any.
+ * Programs are found by process ID from a hash table, both when they
+ * exit and when a window with their _NET_WM_PID appears.
+ */
+struct child {
+	pid_t pid;
+	char *name;
+	struct pane *pane;
+	struct timespec start;
+	struct child *next;
+};
+
+#ifndef CHILD_BUCKETS
+#define CHILD_BUCKETS 64		/* Power of two */
+#endif
+
+static struct child *children[CHILD_BUCKETS];
+
+static struct spawn_stats stats;
+
+#define ELAPSED_MS(a, b) ((long) (((b).tv_sec - (a).tv_sec) * 1000 + \
+	((b).tv_nsec - (a).tv_nsec) / 1000000))
+
+#define BUCKET(pid) (&children[(unsigned long) (pid) & (CHILD_BUCKETS - 1)])
+
+/*
+ * Set up once, see spawn_init().
+ */
+static char **env;
+static posix_spawnattr_t attr;
+static const char *shell;
+
+/*
+ * SIGCHLD sets the flag and writes to the pipe, which wakes up the
+ * main loop if it is waiting for events, see spawn_fd().
+ */
+static volatile sig_atomic_t exited;
+static int sigpipe[2];
+
+/*
+ * Characters that make a command need the shell, and those of them
+ * that keep the shell from simply exec'ing the command.
+ */
+#define SHELL_CHARS "|&;<>()$`\\\"'*?[]#~=%{}\n"
+#define SHELL_OPS "|&;(){}!\n"
+
+static pid_t spawn_vec(char *const []);
+static struct child **find_child(pid_t);
+static pid_t parent_of(pid_t);
+static void sigchld(int);
+
+/*
+ * Prepares the environment and attributes of the programs to start,
+ * which are the same for all of them.
+ */
+void
+spawn_init(Display *display)
+{
+	static const char dpy[] = "DISPLAY=";
+	struct sigaction sa;
+	sigset_t none;
+	size_t i, n;
+	char *s;
+	short flags;
+
+	for (n = 0; environ[n] != NULL; n++)
+		;
+	if ((env = calloc(n + 2, sizeof(*env))) == NULL)
+		err(1, "spawn environment");
+
+	for (i = n = 0; environ[i] != NULL; i++)
+		if (strncmp(environ[i], dpy, sizeof(dpy) - 1) != 0)
+			env[n++] = environ[i];
+	if ((s = malloc(sizeof(dpy) + strlen(DisplayString(display)))) == NULL)
+		err(1, "spawn environment");
+	strcpy(s, dpy);
+	strcat(s, DisplayString(display));
+	env[n] = s;
+
+	if ((shell = getenv("SHELL")) == NULL || *shell == '\0')
+		shell = "/bin/sh";
+
+	if (pipe(sigpipe) == -1)
+		err(1, "pipe");
+	for (i = 0; i < 2; i++)
+		if (fcntl(sigpipe[i], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC) == -1)
+			err(1, "fcntl");
+	sa.sa_handler = sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGCHLD, &sa, NULL) == -1)
+		err(1, "sigaction");
+
+	/*
+	 * Programs go to a session of their own so that they outlive
+	 * us, and get no signals meant for us.
+	 */
+	sigemptyset(&none);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	flags = POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_SETSID
+	flags |= POSIX_SPAWN_SETSID;
+#else
+	flags |= POSIX_SPAWN_SETPGROUP;
+	posix_spawnattr_setpgroup(&attr, 0);
+#endif
+	posix_spawnattr_setflags(&attr, flags);
+}
+
+static pid_t
+spawn_vec(char *const argv[])
+{
+	struct child *c;
+	pid_t pid;
+	int error;
+
+	if ((c = malloc(sizeof(*c))) == NULL ||
+	    (c->name = strdup(argv[0])) == NULL) {
+		warn("spawn");
+		free(c);
+		return -1;
+	}
+
+	error = posix_spawnp(&pid, argv[0], NULL, &attr, argv, env);
+	if (error != 0) {
+		errno = error;
+		warn("%s", argv[0]);
+		stats.failed++;
+		free(c->name);
+		free(c);
+		return -1;
+	}
+	TRACE("spawned %s, pid %ld", argv[0], (long) pid);
+	stats.started++;
+
+	c->pid = pid;
+	c->pane = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	c->next = *BUCKET(pid);
+	*BUCKET(pid) = c;
+
+	return pid;
+}
+
+/*
+ * Starts a command line (s). Returns the process ID, or -1.
+ */
+pid_t
+spawn(const char *s)
+{
+	char *argv[PROMPT_MAX / 2 + 1], *q, *p, *last;
+	size_t n;
+	pid_t pid;
+
+	/*
+	 * A simple command is exec'd by the shell, so that its window has
+	 * the process ID we know. Otherwise the window is matched by the
+	 * shell being its parent, see spawn_claim().
+	 */
+	if (strpbrk(s, SHELL_CHARS) != NULL) {
+		n = strcspn(s, " \t");
+		if (strpbrk(s, SHELL_OPS) == NULL &&
+		    memchr(s, '=', n) == NULL &&
+		    (q = malloc(strlen(s) + 6)) != NULL) {
+			strcpy(q, "exec ");
+			strcat(q, s);
+		} else
+			q = NULL;
+		argv[0] = (char *) shell;
+		argv[1] = "-c";
+		argv[2] = (q != NULL) ? q : (char *) s;
+		argv[3] = NULL;
+		pid = spawn_vec(argv);
+		free(q);
+		return pid;
+	}
+
+	if ((q = strdup(s)) == NULL) {
+		warn("spawn");
+		return -1;
+	}
+	n = 0;
+	for (p = strtok_r(q, " \t", &last); p != NULL &&
+	    n < sizeof(argv) / sizeof(argv[0]) - 1;
+	    p = strtok_r(NULL, " \t", &last))
+		argv[n++] = p;
+	argv[n] = NULL;
+
+	pid = (n > 0) ? spawn_vec(argv) : -1;
+	free(q);
+
+	return pid;
+}
+
+/*
+ * Starts a program with (argc) arguments (argv), as from WM_COMMAND.
+ */
+pid_t
+spawn_argv(int argc, char **argv)
+{
+	char **v;
+	pid_t pid;
+
+	if (argc <= 0)
+		return -1;
+
+	if ((v = calloc(argc + 1, sizeof(*v))) == NULL) {
+		warn("spawn");
+		return -1;
+	}
+	memcpy(v, argv, argc * sizeof(*v));
+	pid = spawn_vec(v);
+	free(v);
+
+	return pid;
+}
+
+static struct child **
+find_child(pid_t pid)
+{
+	struct child **c;
+
+	for (c = BUCKET(pid); *c != NULL; c = &(*c)->next)
+		if ((*c)->pid == pid)
+			break;
+
+	return c;
+}
+
+static void
+sigchld(int sig)
+{
+	int saved_errno = errno;
+
+	exited = 1;
+	write(sigpipe[1], "", 1);
+	errno = saved_errno;
+}
+
+/*
+ * Descriptor that becomes readable when a program we started exits.
+ */
+int
+spawn_fd()
+{
+	return sigpipe[0];
+}
+
+/*
+ * Collects the exit status of all programs that have exited, so they
+ * do not linger as zombies, and closes the panes still held for their
+ * windows in the layout (l). Does nothing unless SIGCHLD was caught.
+ */
+void
+spawn_reap(struct layout *l)
+{
+	struct child **c, *dead;
+	struct timespec now;
+	char buf[64];
+	pid_t pid;
+	int status;
+
+	if (!exited)
+		return;
+	exited = 0;
+	while (read(sigpipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if (*(c = find_child(pid)) == NULL) {
+			TRACE("pid %ld exited", (long) pid);
+			continue;
+		}
+		dead = *c;
+		*c = dead->next;
+
+		snprintf(stats.last, sizeof(stats.last), "%s", dead->name);
+		stats.last_ms = ELAPSED_MS(dead->start, now);
+		if (WIFSIGNALED(status)) {
+			stats.killed++;
+			stats.last_status = -WTERMSIG(status);
+			TRACE("pid %ld (%s) killed by signal %d after %ld ms",
+			    (long) pid, dead->name, WTERMSIG(status),
+			    stats.last_ms);
+		} else {
+			if (WEXITSTATUS(status) == 0)
+				stats.exited++;
+			else
+				stats.errors++;
+			stats.last_status = WEXITSTATUS(status);
+			TRACE("pid %ld (%s) exited with %d after %ld ms",
+			    (long) pid, dead->name, WEXITSTATUS(status),
+			    stats.last_ms);
+		}
+
+		/* Exited without a window of its own */
+		if (dead->pane != NULL)
+			close_pane(dead->pane, l);
+
+		free(dead->name);
+		free(dead);
+	}
+}
+
+/*
+ * Holds pane (p) for the first window of a program (pid).
+ */
+void
+spawn_reserve(pid_t pid, struct pane *p)
+{
+	struct child *child;
+
+	spawn_forget(p);
+	if ((child = *find_child(pid)) != NULL)
+		child->pane = p;
+}
+
+/*
+ * Returns the parent of a process (pid), or -1 if it cannot be found.
+ */
+static pid_t
+parent_of(pid_t pid)
+{
+#if defined(__OpenBSD__)
+	int mib[6] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid,
+	    sizeof(struct kinfo_proc), 1 };
+	struct kinfo_proc kp;
+	size_t len = sizeof(kp);
+
+	if (sysctl(mib, 6, &kp, &len, NULL, 0) == -1 || len == 0)
+		return -1;
+	return kp.p_ppid;
+#elif defined(__linux__)
+	char path[64], buf[512], *s;
+	long ppid;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stat", (long) pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	s = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+
+	/* The name in parentheses may contain anything */
+	if (s == NULL || (s = strrchr(buf, ')')) == NULL ||
+	    sscanf(s + 1, " %*c %ld", &ppid) != 1)
+		return -1;
+	return ppid;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Returns the pane held for the first window of a program (pid), or
+ * NULL if there is none. A program started by a shell of ours that did
+ * not exec it, e.g. in a pipeline, takes the pane held for the shell.
+ */
+struct pane *
+spawn_claim(pid_t pid)
+{
+	struct child *child;
+	struct timespec now;
+	struct pane *p;
+
+	if (pid <= 0)
+		return NULL;
+	if ((child = *find_child(pid)) == NULL || child->pane == NULL) {
+		pid = parent_of(pid);
+		if (pid <= 0 || (child = *find_child(pid)) == NULL ||
+		    child->pane == NULL)
+			return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	TRACE("pid %ld (%s) mapped %ld ms after launch", (long) pid,
+	    child->name, ELAPSED_MS(child->start, now));
+
+	p = child->pane;
+	child->pane = NULL;
+
+	return p;
+}
+
+/*
+ * A pane (p) is no longer held for any window.
+ */
+void
+spawn_forget(struct pane *p)
+{
+	struct child *c;
+	int i;
+
+	for (i = 0; i < CHILD_BUCKETS; i++)
+		for (c = children[i]; c != NULL; c = c->next)
+			if (c->pane == p)
+				c->pane = NULL;
+}
+
+/*
+ * Counts of the programs started and how they ended, for "metrics" of
+ * the control socket.
+ */
+const struct spawn_stats *
+spawn_stats()
+{
+	return &stats;
+}
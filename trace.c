@@ -69,7 +69,7 @@ str_op(int op)
 		"MoveColumn", "KillPane", "RestartManager",
 		"ToggleTagMode", "Maximize", "QuitManager", "Minimize",
 		"Fullscreen", "PrevFocus", "EditCommand", "NewCommand",
-		"RestartCommand", "ToggleMode",
+		"RestartCommand", "ToggleMode", "ReloadKeys",
 		NULL
 	};
 
@@ -94,7 +94,7 @@ const char *
 str_target(int target)
 {
 	static const char *s[] = {
-		"NoTarget", "Forward", "Backward", NULL
+		"NoTarget", "Backward", "Forward", "Others", NULL
 	};
 
 	return s[target];
@@ -1,6 +1,7 @@
 /* trace.c */
 const char *str_event   (XEvent *);
 const char *str_op      (int);
+const char *str_target  (int);
 const char *str_pane    (struct pane *pane);
 void        dump_column (struct column *);
 const char *dump_flags  (int flags);